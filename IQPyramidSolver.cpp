@@ -1,18 +1,37 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <array>
+#include <map>
+#include <unordered_map>
+#include <queue>
+#include <sstream>
 #include <fstream>
 #include <chrono>
+#include <numeric>
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <thread>
+#include <random>
 
 #if defined(_WIN32) || defined(_WIN64)	// 在windows下所需的头文件
-#include <numeric>
 #include <Windows.h>
+#include <intrin.h>
+#else	// 映射文件到内存所需的头文件
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 #include <boost/program_options.hpp>
 
 //#undef USING_TBB	// 不使用TBB库
 #define USING_TBB	// 使用TBB库
+//#define USING_STATS	// 统计搜索树每层的节点数、分支数和舞蹈链的更新次数,求解会变慢
 
 #ifdef USING_TBB
 #include <tbb/tbb.h>
@@ -34,7 +53,7 @@ static const int PIECES = 12;
 // OO  OO  O   OO  OO      OOO  OO OO  O        O
 //         OO  O    O                  O
 // ------------------------------------------------
-static const unsigned int PieceData[PIECES][4] = {
+static constexpr unsigned int PieceData[PIECES][4] = {
 	{ 0b1000, 0b1000, 0b1100, 0b0000 },
 	{ 0b1000, 0b1100, 0b1100, 0b0000 },
 	{ 0b1000, 0b1000, 0b1000, 0b1100 },
@@ -48,10 +67,129 @@ static const unsigned int PieceData[PIECES][4] = {
 	{ 0b1100, 0b1100, 0b0000, 0b0000 },
 	{ 0b0100, 0b1110, 0b0100, 0b0000 }
 };
-// 每块积木的不同形状的数目
-static const int rotates[] = { 8, 8, 8, 8, 8, 4, 4, 4, 4, 2, 1, 1 };
-// 并行化舞蹈链求解时广度优先分解的层数
-static const int FACTOR = 3;
+
+// 积木的一个形状,用4*4矩阵中占据的点的掩码表示,第y行第x列对应第y*4+x位
+typedef unsigned int ShapeMask;
+
+// 使形状紧贴矩阵的左上角
+constexpr ShapeMask NormalizeShape(ShapeMask mask)
+{
+	while ((mask & 0x000F) == 0)
+		mask >>= 4;
+	while ((mask & 0x1111) == 0)
+		mask >>= 1;
+	return mask;
+}
+
+// 顺时针旋转90度
+constexpr ShapeMask RotateShape(ShapeMask mask)
+{
+	ShapeMask result = 0;
+	for (int y = 0; y < 4; y++)
+		for (int x = 0; x < 4; x++)
+			if ((mask & (1u << (y * 4 + x))) != 0)
+				result |= 1u << (x * 4 + 3 - y);
+	return NormalizeShape(result);
+}
+
+// 水平翻转
+constexpr ShapeMask FlipShape(ShapeMask mask)
+{
+	ShapeMask result = 0;
+	for (int y = 0; y < 4; y++)
+		for (int x = 0; x < 4; x++)
+			if ((mask & (1u << (y * 4 + x))) != 0)
+				result |= 1u << (y * 4 + 3 - x);
+	return NormalizeShape(result);
+}
+
+// 每块积木的所有不同形状
+struct ShapeTable
+{
+	ShapeMask shapes[PIECES][8];
+	int count[PIECES];
+};
+
+// 依次旋转3次,翻转,再旋转3次,去掉重复的形状,编译时求出
+constexpr ShapeTable MakeShapes()
+{
+	ShapeTable table{};
+	for (int block_index = 0; block_index < PIECES; block_index++)
+	{
+		ShapeMask mask = 0;
+		for (int y = 0; y < 4; y++)
+			for (int x = 0; x < 4; x++)
+				if ((PieceData[block_index][y] & (1u << (3 - x))) != 0)
+					mask |= 1u << (y * 4 + x);
+		mask = NormalizeShape(mask);
+		for (int i = 0; i < 8; i++)
+		{
+			bool found = false;
+			for (int j = 0; j < table.count[block_index]; j++)
+				found = found || table.shapes[block_index][j] == mask;
+			if (!found)
+				table.shapes[block_index][table.count[block_index]++] = mask;
+			mask = i == 3 ? FlipShape(mask) : RotateShape(mask);
+		}
+	}
+	return table;
+}
+static constexpr ShapeTable Shapes = MakeShapes();
+
+constexpr int ShapeTotal()
+{
+	int total = 0;
+	for (int block_index = 0; block_index < PIECES; block_index++)
+		total += Shapes.count[block_index];
+	return total;
+}
+static_assert(ShapeTotal() == 60, "12块积木共有60个不同的形状");
+
+// 一块积木最多占据的格子数,Step和解都按这个上限定长存放
+static const int PIECE_CELLS = 5;
+
+constexpr int MaxPieceCells()
+{
+	int result = 0;
+	for (int block_index = 0; block_index < PIECES; block_index++)
+	{
+		int cells = 0;
+		for (ShapeMask mask = Shapes.shapes[block_index][0]; mask != 0; mask &= mask - 1)
+			cells++;
+		result = cells > result ? cells : result;
+	}
+	return result;
+}
+static_assert(MaxPieceCells() == PIECE_CELLS, "每块积木最多占据5个格子");
+
+// 自动分解子树时部分解的最大层数
+static const int AUTO_LEVEL_MAX = 6;
+// 自动分解子树时,最大的子树不超过总量的1/(BALANCE*线程数)
+static const int BALANCE = 4;
+// 估计一个子树的大小时随机探测的次数
+static const int PROBES = 32;
+// 动态分解子树时,只在不超过这个深度的节点上把分支分给空闲的线程
+static const int SPLIT_DEPTH = 8;
+// 边搜索边输出时,每个线程攒够这么多个解后交给写文件线程
+static const int STREAM_BATCH = 64;
+// 边搜索边输出时,等待写文件的批次数目的上限
+static const int STREAM_QUEUE = 256;
+// 分片求解时自动分解子树按每个进程有这么多个线程计算,与实际的线程数无关,各进程分解出的子树相同
+static const int SHARD_THREADS = 8;
+// zdd引擎每个线程默认记住的状态数目为2的这个次幂,每个状态占16字节,共64MB
+static const int ZDD_MEMO_BITS = 22;
+// 求解器每搜索这么多个节点向进度报告一次,必须是2的幂
+static const int NODE_BATCH = 1 << 16;
+// 文本输出的缓冲区攒够这么多字节后一次写出
+static const int RENDER_BUFFER = 1 << 16;
+// 压缩格式的解文件中每段的解数,读取第k个解时最多解码这么多个解
+static const int ARCHIVE_BLOCK = 256;
+// 显示进度的间隔,毫秒
+static const int PROGRESS_INTERVAL = 500;
+// 基准测试中每项微小操作至少重复执行的时间,秒
+static const double BENCHMARK_TIME = 0.2;
+// 基准测试中广度优先展开的最大层数
+static const int BENCHMARK_SPREAD_MAX = 3;
 
 // 每块积木的代号,答案显示时用
 static const string piece_map[PIECES] = { "A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L" };
@@ -101,72 +239,176 @@ struct Point
 // 由于有12块积木,一个完整的解包含这12块积木的形状,位置
 // 一个Step包含积木序号,形状序号,x和y坐标
 // 因此一个完整的解包含12个Step
+// 一个Step中积木占据的格子,定长存放,复制Step时不需要分配内存
+struct StepCells
+{
+	std::array<int, PIECE_CELLS> cells;
+	int count;
+	StepCells() : count(0) {}
+	void clear() { count = 0; }
+	void push_back(int index) { cells[count++] = index; }
+	size_t size() const { return (size_t)(count); }
+	const int* begin() const { return cells.data(); }
+	const int* end() const { return cells.data() + count; }
+	int operator[](int i) const { return cells[i]; }
+	bool operator<(const StepCells& other) const { return std::lexicographical_compare(begin(), end(), other.begin(), other.end()); }
+	bool operator==(const StepCells& other) const { return count == other.count && std::equal(begin(), end(), other.begin()); }
+	bool operator!=(const StepCells& other) const { return !(*this == other); }
+};
+
 struct Step
 {
 	int block_index, shape_index, x, y;
-	vector<int> indecies;
-	Step(int block_index, int shape_index, int x, int y) : block_index(block_index), shape_index(shape_index), x(x), y(y) { indecies.clear(); }
+	StepCells indecies;
+	Step(int block_index, int shape_index, int x, int y) : block_index(block_index), shape_index(shape_index), x(x), y(y) {}
 };
 
-// 每块积木的每个形状的数据
-// 主要保存了形状在4*4矩阵中占据的点
-class Piece
+// 关系矩阵中行的固定顺序:按积木、形状和占据的位置排列,与生成时的线程和先后无关,
+// 同一个图案每次运行时各行的编号相同
+inline bool StepOrder(const Step& step1, const Step& step2)
+{
+	if (step1.block_index != step2.block_index)
+		return step1.block_index < step2.block_index;
+	if (step1.shape_index != step2.shape_index)
+		return step1.shape_index < step2.shape_index;
+	return step1.indecies < step2.indecies;
+}
+
+// 输出时两个Step的先后:依次比较积木序号、形状、位置和占据的格子
+inline bool StepOutputOrder(const Step& step1, const Step& step2)
+{
+	if (step1.block_index != step2.block_index)
+		return step1.block_index < step2.block_index;
+	if (step1.shape_index != step2.shape_index)
+		return step1.shape_index < step2.shape_index;
+	if (step1.x != step2.x)
+		return step1.x < step2.x;
+	if (step1.y != step2.y)
+		return step1.y < step2.y;
+	return step1.indecies < step2.indecies;
+}
+
+// 解的输出顺序:按积木序号排列的解,依次比较各块积木的形状和位置
+// 是严格的全序,每次运行以及多个分片的结果合并后顺序都相同
+inline bool SolutionOrder(const vector<Step>& solution1, const vector<Step>& solution2)
+{
+	return std::lexicographical_compare(solution1.begin(), solution1.end(), solution2.begin(), solution2.end(), StepOutputOrder);
+}
+
+// 由行号表示的一个解,每块积木最多占一行,定长存放,保存和排序时不需要分配内存
+// 关系矩阵的行按积木序号排列,行号按升序排列后即是按积木序号排列
+struct Solution
+{
+	std::array<int, PIECES> rows;
+	int count;
+	Solution() : count(0) {}
+	explicit Solution(const vector<int>& result) : count((int)(result.size()))
+	{
+		std::copy(result.begin(), result.end(), rows.begin());
+		std::sort(rows.begin(), rows.begin() + count);
+	}
+	const int* begin() const { return rows.data(); }
+	const int* end() const { return rows.data() + count; }
+	size_t size() const { return (size_t)(count); }
+};
+
+// 解的紧凑排序键:解中各行按输出顺序的名次加1,每个占16位(与二进制格式相同,行数不超过65535),按积木序号从高位到低位排列,空位为0
+// 依次比较3个整数即得到与SolutionOrder相同的顺序
+struct SolutionKey
+{
+	uint64_t words[3];
+
+	bool operator<(const SolutionKey& other) const
+	{
+		if (words[0] != other.words[0])
+			return words[0] < other.words[0];
+		if (words[1] != other.words[1])
+			return words[1] < other.words[1];
+		return words[2] < other.words[2];
+	}
+};
+
+// 行号与排序键之间的转换
+// 预先把所有行按StepOutputOrder排好,名次的先后即Step输出的先后;行按积木序号排列,名次也是
+class SolutionKeys
 {
 private:
-	static const int WIDTH = 4;
-	static const int HEIGHT = 4;
-	vector<Point> points;
+	vector<int> rank;	// 行号对应的名次加1
+	vector<int> rows;	// 名次加1对应的行号
 
-	// 使形状紧贴矩阵的左上角
-	void Normalize()
+public:
+	template <class Steps>
+	SolutionKeys(const Steps& steps) : rank(steps.size() + 1, 0), rows(steps.size() + 1, 0)
 	{
-		int min_x = WIDTH, min_y = HEIGHT;
-		for (Point p : points)
+		vector<int> order(steps.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [&](int i, int j) { return StepOutputOrder(steps[i], steps[j]); });
+		for (int i = 0; i < (int)(order.size()); i++)
 		{
-			min_x = (std::min)(min_x, p.x);
-			min_y = (std::min)(min_y, p.y);
+			rank[order[i] + 1] = i + 1;
+			rows[i + 1] = order[i] + 1;
 		}
-		for (Point &p : points)
-			p = Point(p.x - min_x, p.y - min_y);
 	}
 
-public:
-	const int block_index;
-	int shape_index;
-
-	// 用点阵数据初始化
-	Piece(const unsigned int(&data)[HEIGHT], int block_index) : block_index(block_index)
+	SolutionKey Key(const vector<int>& solution) const
 	{
-		points.clear();
-		shape_index = 0;
-		for (int i = 0; i < HEIGHT; i++)
-			for (int j = 0; j < WIDTH; j++)
-				if ((data[i] & (1u << (WIDTH - j - 1))) != 0)
-					points.push_back(Point(j, i));
-		Normalize();
+		uint64_t ranks[PIECES] = { 0 };
+		int count = 0;
+		for (int row : solution)
+			ranks[count++] = (uint64_t)(rank[row]);
+		std::sort(ranks, ranks + count);
+		SolutionKey key = { { 0, 0, 0 } };
+		for (int i = 0; i < PIECES; i++)
+			key.words[i / 4] |= ranks[i] << (48 - 16 * (i % 4));
+		return key;
 	}
 
-	// 水平翻转
-	void Flip()
+	void Rows(const SolutionKey& key, Solution& solution) const
 	{
-		for (Point &p : points)
-			p = Point(WIDTH - p.x - 1, p.y);
-		Normalize();
-		shape_index++;
+		solution.count = 0;
+		for (int i = 0; i < PIECES; i++)
+		{
+			int value = (int)((key.words[i / 4] >> (48 - 16 * (i % 4))) & 0xFFFF);
+			if (value != 0)
+				solution.rows[solution.count++] = rows[value];
+		}
 	}
+};
+
+// 每块积木的每个形状的数据
+// 主要保存了形状在4*4矩阵中占据的点
+class Piece
+{
+private:
+	static const int WIDTH = 4;
+	static const int HEIGHT = 4;
+	vector<Point> points;
+	int width, height;
+
+public:
+	const int block_index;
+	const int shape_index;
 
-	// 顺时针旋转90度
-	void Rotate()
+	// 用编译时求出的形状初始化
+	Piece(ShapeMask mask, int block_index, int shape_index) : width(0), height(0), block_index(block_index), shape_index(shape_index)
 	{
-		for (Point &p : points)
-			p = Point(HEIGHT - p.y - 1, p.x);
-		Normalize();
-		shape_index++;
+		for (int y = 0; y < HEIGHT; y++)
+			for (int x = 0; x < WIDTH; x++)
+				if ((mask & (1u << (y * WIDTH + x))) != 0)
+				{
+					points.push_back(Point(x, y));
+					width = (std::max)(width, x + 1);
+					height = (std::max)(height, y + 1);
+				}
 	}
 
 	// 形状占据矩阵点的数量
 	int size() const { return (int)(points.size()); }
 
+	// 形状的宽度和高度,放置形状时不需要逐点检查是否越界
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+
 	// 形状占据矩阵点的集合
 	vector<Point>& getPoints() { return points; }
 };
@@ -175,18 +417,47 @@ public:
 class IPattern
 {
 public:
+	virtual ~IPattern() {}
 	// 图案中所有需要填充的位置数量
 	virtual int size() const = 0;
 	// 获取形状piece在图案中所有可能的位置
+	// 放置表在运行时生成,60个形状在p4图案中共计不到0.2毫秒,只占一次完整求解的几个百分点,不值得为此写成编译时的表
 #ifdef USING_TBB
 	virtual int GetValidSteps(Piece &piece, tbb::concurrent_vector<Step>& steps) const = 0;
 #else
 	virtual int GetValidSteps(Piece& piece, vector<Step>& steps) const = 0;
 #endif
-	// 依据图案的形状输出一个解
-	virtual vector<vector<int> > FormatMatrix(const vector<Step>& solution) const = 0;
+	// 输出解时的版面,每行依次为各个字符对应的位置,0为空白
+	virtual vector<vector<int> > GetLayout() const = 0;
+	// 位棋盘算法填充位置的顺序,沿图案较短的方向逐条填充时搜索最快
+	virtual vector<int> GetFillOrder() const = 0;
+	// 图案的对称群,每个元素是位置编号的一个置换,第一个元素为恒等置换
+	virtual vector<vector<int> > GetSymmetries() const = 0;
+	// 每个位置在积木所在的平面上相邻的位置,下标为位置编号
+	virtual vector<vector<int> > GetNeighbors() const = 0;
 };
 
+// 把一个平面上左右、上下相邻的位置加入neighbors
+// grid为按行排列的位置编号,0表示不属于图案
+void AddGridNeighbors(const vector<int>& grid, int width, vector<vector<int> >& neighbors)
+{
+	for (int i = 0; i < (int)(grid.size()); i++)
+	{
+		if (grid[i] == 0)
+			continue;
+		if ((i + 1) % width != 0 && grid[i + 1] != 0)
+		{
+			neighbors[grid[i]].push_back(grid[i + 1]);
+			neighbors[grid[i + 1]].push_back(grid[i]);
+		}
+		if (i + width < (int)(grid.size()) && grid[i + width] != 0)
+		{
+			neighbors[grid[i]].push_back(grid[i + width]);
+			neighbors[grid[i + width]].push_back(grid[i]);
+		}
+	}
+}
+
 // 高=10,底边=10的三角形图案
 class TrianglePattern : public IPattern
 {
@@ -216,16 +487,12 @@ public:
 #endif
 	{
 		int count = 0;
-		for (int y = 0; y < ORDER; y++)
-			for (int x = 0; x < ORDER; x++)
+		for (int y = 0; y + piece.getHeight() <= ORDER; y++)
+			for (int x = 0; x + piece.getWidth() <= ORDER; x++)
 			{
 				bool valid = true;
 				for (Point p : piece.getPoints())
-				{
-					if (p.x + x < 0 || p.x + x >= ORDER) { valid = false; break; }
-					if (p.y + y < 0 || p.y + y >= ORDER) { valid = false; break; }
 					if (matrix[(p.y + y) * ORDER + p.x + x] == 0) { valid = false; break; }
-				}
 				if (valid)
 				{
 					Step step(piece.block_index, piece.shape_index, x, y);
@@ -238,13 +505,8 @@ public:
 		return count;
 	}
 
-	vector<vector<int> > FormatMatrix(const vector<Step>& solution) const
+	vector<vector<int> > GetLayout() const
 	{
-		vector<int> piece_matrix(size() + 1, 0);
-		for (Step step : solution)
-			for (int index : step.indecies)
-				piece_matrix[index] = step.block_index;
-
 		vector<vector<int> > result;
 		int index = 0;
 		for (int y = 0; y < ORDER; y++)
@@ -252,10 +514,40 @@ public:
 			result.push_back(vector<int>());
 			for (int x = 0; x < ORDER; x++)
 				if (x <= y)
-					result[y].push_back(piece_matrix[++index]);
+					result[y].push_back(++index);
 		}
 		return result;
 	}
+
+	// 从斜边开始,逐条填充与斜边平行的位置
+	vector<int> GetFillOrder() const
+	{
+		vector<int> order;
+		for (int d = 0; d < ORDER; d++)
+			for (int x = 0; x + d < ORDER; x++)
+				order.push_back(matrix[(x + d) * ORDER + x]);
+		return order;
+	}
+
+	// 关于底边中垂线的镜像
+	vector<vector<int> > GetSymmetries() const
+	{
+		vector<vector<int> > symmetries(2, vector<int>(size() + 1, 0));
+		for (int y = 0; y < ORDER; y++)
+			for (int x = 0; x <= y; x++)
+			{
+				symmetries[0][matrix[y * ORDER + x]] = matrix[y * ORDER + x];
+				symmetries[1][matrix[y * ORDER + x]] = matrix[(ORDER - 1 - x) * ORDER + ORDER - 1 - y];
+			}
+		return symmetries;
+	}
+
+	vector<vector<int> > GetNeighbors() const
+	{
+		vector<vector<int> > neighbors(size() + 1);
+		AddGridNeighbors(matrix, ORDER, neighbors);
+		return neighbors;
+	}
 };
 
 // 宽=11,高=5的矩形图案
@@ -285,16 +577,12 @@ public:
 #endif
 	{
 		int count = 0;
-		for (int y = 0; y < HEIGHT; y++)
-			for (int x = 0; x < WIDTH; x++)
+		for (int y = 0; y + piece.getHeight() <= HEIGHT; y++)
+			for (int x = 0; x + piece.getWidth() <= WIDTH; x++)
 			{
 				bool valid = true;
 				for (Point p : piece.getPoints())
-				{
-					if (p.x + x < 0 || p.x + x >= WIDTH) { valid = false; break; }
-					if (p.y + y < 0 || p.y + y >= HEIGHT) { valid = false; break; }
 					if (matrix[(p.y + y) * WIDTH + p.x + x] == 0) { valid = false; break; }
-				}
 				if (valid)
 				{
 					Step step(piece.block_index, piece.shape_index, x, y);
@@ -307,23 +595,50 @@ public:
 		return count;
 	}
 
-	vector<vector<int> > FormatMatrix(const vector<Step>& solution) const
+	vector<vector<int> > GetLayout() const
 	{
-		vector<int> piece_matrix(size() + 1, 0);
-		for (Step step : solution)
-			for (int index : step.indecies)
-				piece_matrix[index] = step.block_index;
-
 		vector<vector<int> > result;
 		int index = 0;
 		for (int y = 0; y < HEIGHT; y++)
 		{
 			result.push_back(vector<int>());
 			for (int x = 0; x < WIDTH; x++)
-				result[y].push_back(piece_matrix[++index]);
+				result[y].push_back(++index);
 		}
 		return result;
 	}
+
+	// 逐列填充
+	vector<int> GetFillOrder() const
+	{
+		vector<int> order;
+		for (int x = 0; x < WIDTH; x++)
+			for (int y = 0; y < HEIGHT; y++)
+				order.push_back(matrix[y * WIDTH + x]);
+		return order;
+	}
+
+	// 水平镜像,垂直镜像和旋转180度
+	vector<vector<int> > GetSymmetries() const
+	{
+		vector<vector<int> > symmetries(4, vector<int>(size() + 1, 0));
+		for (int y = 0; y < HEIGHT; y++)
+			for (int x = 0; x < WIDTH; x++)
+				for (int i = 0; i < 4; i++)
+				{
+					int sx = (i & 1) ? WIDTH - 1 - x : x;
+					int sy = (i & 2) ? HEIGHT - 1 - y : y;
+					symmetries[i][matrix[y * WIDTH + x]] = matrix[sy * WIDTH + sx];
+				}
+		return symmetries;
+	}
+
+	vector<vector<int> > GetNeighbors() const
+	{
+		vector<vector<int> > neighbors(size() + 1);
+		AddGridNeighbors(matrix, WIDTH, neighbors);
+		return neighbors;
+	}
 };
 
 // 金字塔形图案
@@ -393,16 +708,12 @@ public:
 		int count = 0;
 		for (int floor = 0; floor < ORDER; floor++)
 		{
-			for (int y = 0; y <= floor; y++)
-				for (int x = 0; x <= floor; x++)
+			for (int y = 0; y + piece.getHeight() <= floor + 1; y++)
+				for (int x = 0; x + piece.getWidth() <= floor + 1; x++)
 				{
 					bool valid = true;
 					for (Point p : piece.getPoints())
-					{
-						if (p.x + x < 0 || p.x + x > floor) { valid = false; break; }
-						if (p.y + y < 0 || p.y + y > floor) { valid = false; break; }
 						if (floors[floor][(p.y + y) * (floor + 1) + p.x + x] == 0) { valid = false; break; }
-					}
 					if (valid)
 					{
 						Step step(piece.block_index, (floor << 3) | piece.shape_index, x, y);
@@ -417,16 +728,12 @@ public:
 		for (int plane = 0; plane < 2 * ORDER - 1; plane++)
 		{
 			int size = ORDER - std::abs(ORDER - 1 - plane);
-			for (int y = 0; y < size; y++)
-				for (int x = 0; x < size; x++)
+			for (int y = 0; y + piece.getHeight() <= size; y++)
+				for (int x = 0; x + piece.getWidth() <= size; x++)
 				{
 					bool valid = true;
 					for (Point p : piece.getPoints())
-					{
-						if (p.x + x < 0 || p.x + x >= size) { valid = false; break; }
-						if (p.y + y < 0 || p.y + y >= size) { valid = false; break; }
 						if (diagonals_left[plane][(p.y + y) * size + p.x + x] == 0) { valid = false; break; }
-					}
 					if (valid)
 					{
 						Step step(piece.block_index, (1 << 6) | (plane << 3) | piece.shape_index, x, y);
@@ -441,16 +748,12 @@ public:
 		for (int plane = 0; plane < 2 * ORDER - 1; plane++)
 		{
 			int size = ORDER - abs(ORDER - 1 - plane);
-			for (int y = 0; y < size; y++)
-				for (int x = 0; x < size; x++)
+			for (int y = 0; y + piece.getHeight() <= size; y++)
+				for (int x = 0; x + piece.getWidth() <= size; x++)
 				{
 					bool valid = true;
 					for (Point p : piece.getPoints())
-					{
-						if (p.x + x < 0 || p.x + x >= size) { valid = false; break; }
-						if (p.y + y < 0 || p.y + y >= size) { valid = false; break; }
 						if (diagonals_right[plane][(p.y + y) * size + p.x + x] == 0) { valid = false; break; }
-					}
 					if (valid)
 					{
 						Step step(piece.block_index, (1 << 7) | (plane << 3) | piece.shape_index, x, y);
@@ -464,17 +767,9 @@ public:
 		return count;
 	}
 
-	vector<vector<int> > FormatMatrix(const vector<Step>& solution) const
+	// 各层左右并排,层与层之间空一格
+	vector<vector<int> > GetLayout() const
 	{
-		vector<int> piece_matrix(size() + 1, 0);
-		for (Step step : solution)
-		{
-			for (int index : step.indecies)
-			{
-				piece_matrix[index] = step.block_index;
-			}
-		}
-
 		vector<vector<int> > result;
 		for (int i = 0; i < ORDER; i++)
 		{
@@ -484,292 +779,4169 @@ public:
 				for (int k = 0; k <= j; k++)
 				{
 					if (j >= i)
-						result[i].push_back(piece_matrix[floors[j][i * (j + 1) + k]]);
+						result[i].push_back(floors[j][i * (j + 1) + k]);
 					else
-						result[i].push_back(-1);
+						result[i].push_back(0);
 				}
-				result[i].push_back(-1);;
+				result[i].push_back(0);
 			}
 		}
 		return result;
 	}
-};
 
-// 舞蹈链算法实现
-class DancingLinkX
-{
-private:
-	vector<int> Left;
-	vector<int> Right;
-	vector<int> Up;
-	vector<int> Down;
+	// 从塔顶开始逐层填充
+	vector<int> GetFillOrder() const
+	{
+		vector<int> order;
+		for (int index = 1; index <= size(); index++)
+			order.push_back(index);
+		return order;
+	}
 
-	vector<int> Column;
-	vector<int> Row;
+	// 绕中轴旋转和关于4个竖直平面的镜像,在每个水平面上都是正方形的对称变换
+	vector<vector<int> > GetSymmetries() const
+	{
+		vector<vector<int> > symmetries(8, vector<int>(size() + 1, 0));
+		for (int floor = 0; floor < ORDER; floor++)
+			for (int y = 0; y <= floor; y++)
+				for (int x = 0; x <= floor; x++)
+				{
+					const int n = floor;
+					const int images[8][2] = {
+						{ x, y }, { n - y, x }, { n - x, n - y }, { y, n - x },
+						{ n - x, y }, { x, n - y }, { y, x }, { n - y, n - x }
+					};
+					for (int i = 0; i < 8; i++)
+						symmetries[i][floors[floor][y * (floor + 1) + x]] = floors[floor][images[i][1] * (floor + 1) + images[i][0]];
+				}
+		return symmetries;
+	}
 
-	vector<int> Count;
-	vector<int> Header;
+	// 积木可以放在水平面和两组纵切面上,合并各个平面上的相邻关系
+	vector<vector<int> > GetNeighbors() const
+	{
+		vector<vector<int> > neighbors(size() + 1);
+		for (int floor = 0; floor < ORDER; floor++)
+			AddGridNeighbors(floors[floor], floor + 1, neighbors);
+		for (int plane = 0; plane < 2 * ORDER - 1; plane++)
+		{
+			int size = ORDER - std::abs(ORDER - 1 - plane);
+			AddGridNeighbors(diagonals_left[plane], size, neighbors);
+			AddGridNeighbors(diagonals_right[plane], size, neighbors);
+		}
+		for (vector<int>& cells : neighbors)
+		{
+			std::sort(cells.begin(), cells.end());
+			cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+		}
+		return neighbors;
+	}
+};
 
-	int counter;
+// 按积木序号,形状序号,x和y坐标比较两步的先后,与输出时解的排序方式一致
+inline bool StepLess(const Step& step1, const Step& step2)
+{
+	if (step1.block_index != step2.block_index)
+		return step1.block_index < step2.block_index;
+	else if (step1.shape_index != step2.shape_index)
+		return step1.shape_index < step2.shape_index;
+	else if (step1.x != step2.x)
+		return step1.x < step2.x;
+	return step1.y < step2.y;
+}
 
-	vector<int> Answer;
-	vector<vector<int>> Answers;
+// 图案的对称性
+// 对称群中的每个变换把关系矩阵的每一行映射为同一块积木的另一行
+// 一组互相对称的解中,把各行的序号从小到大排列后最小的解作为这组解的代表
+// 代表解中序号最小的积木一定位于它所在等价类中最小的位置上,
+// 因此建立关系矩阵时只保留这块积木在每个等价类中最小的位置,不会漏掉任何代表解
+// 不限制积木的位置时,搜索全部解,逐个判断是否为代表
+class Symmetry
+{
+private:
+	vector<vector<int> > RowMap;	// RowMap[g][row]为第row行在变换g下的像
+	vector<int> Rank;				// 每一行按StepLess排序后的序号
+	vector<int> Block;				// 每一行的积木序号
+	vector<bool> Representative;	// 每一行是否为所在等价类中最小的一行
+	int restricted;					// 建立关系矩阵时被限制位置的积木,-1表示没有
 
-	int max_column;
+	// 解在变换g下的像中各行的序号,从小到大排列,解最多有PIECES行
+	int Key(const vector<int>& solution, int g, int(&key)[PIECES]) const
+	{
+		int n = 0;
+		for (int row : solution)
+			key[n++] = Rank[RowMap[g][row]];
+		std::sort(key, key + n);
+		return n;
+	}
 
 public:
-	// 构造函数
-	DancingLinkX(int node_count, int row_count, int column_count, bool isComplete)
+	// restrict为false时不限制积木的位置
+	template <class Steps>
+	Symmetry(const IPattern& pattern, const Steps& steps, bool restrict = true)
 	{
-		Left.resize(node_count, 0);
-		Right.resize(node_count, 0);
-		Up.resize(node_count, 0);
-		Down.resize(node_count, 0);
-
-		Column.resize(node_count, 0);
-		Row.resize(node_count, 0);
-
-		Count.resize(column_count + 1, 0);
-		Header.resize(row_count + 1, 0);
-
-		max_column = isComplete ? column_count : column_count - PIECES;
+		int row_count = (int)(steps.size());
+		map<pair<int, vector<int> >, int> rows;
+		for (int i = 0; i < row_count; i++)
+		{
+			vector<int> cells(steps[i].indecies.begin(), steps[i].indecies.end());
+			std::sort(cells.begin(), cells.end());
+			rows[make_pair(steps[i].block_index, cells)] = i + 1;
+		}
 
-		for (int i = 0; i <= column_count; i++)
+		// 在图案的对称变换下,所有行都应映射为另一行,否则这个变换不是关系矩阵的对称变换
+		for (const vector<int>& permutation : pattern.GetSymmetries())
 		{
-			Left[i] = i == 0 ? column_count : i - 1;
-			Right[i] = i == column_count ? 0 : i + 1;
-			Up[i] = i;
-			Down[i] = i;
+			vector<int> row_map(row_count + 1, 0);
+			bool valid = true;
+			for (int i = 0; i < row_count && valid; i++)
+			{
+				vector<int> cells;
+				for (int index : steps[i].indecies)
+					cells.push_back(permutation[index]);
+				std::sort(cells.begin(), cells.end());
+				auto it = rows.find(make_pair(steps[i].block_index, cells));
+				if (it == rows.end())
+					valid = false;
+				else
+					row_map[i + 1] = it->second;
+			}
+			if (valid)
+				RowMap.push_back(row_map);
+		}
 
-			Column[i] = i;
-			Row[i] = 0;
+		vector<int> order(row_count);
+		for (int i = 0; i < row_count; i++)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [&](int i, int j) { return StepLess(steps[i], steps[j]); });
+		Rank.resize(row_count + 1, 0);
+		for (int i = 0; i < row_count; i++)
+			Rank[order[i] + 1] = i + 1;
 
-			Count[i] = 0;
+		Block.resize(row_count + 1, -1);
+		Representative.resize(row_count + 1, true);
+		restricted = -1;
+		for (int row = 1; row <= row_count; row++)
+		{
+			Block[row] = steps[row - 1].block_index;
+			if (restricted == -1 || Block[row] < restricted)
+				restricted = Block[row];
+			for (int g = 1; g < (int)(RowMap.size()); g++)
+				if (Rank[RowMap[g][row]] < Rank[row])
+					Representative[row] = false;
 		}
-		counter = column_count;
+		if (RowMap.size() <= 1 || !restrict)
+			restricted = -1;
 	}
 
-	// 从已有的DancingLinkX数据结构复制出一个对象
-	DancingLinkX(const DancingLinkX& dlx)
-	{
-		Left = vector<int>(dlx.Left);
-		Right = vector<int>(dlx.Right);
-		Up = vector<int>(dlx.Up);
-		Down = vector<int>(dlx.Down);
-
-		Column = vector<int>(dlx.Column);
-		Row = vector<int>(dlx.Row);
+	// 对称群的阶
+	int size() const { return (int)(RowMap.size()); }
 
-		Count = vector<int>(dlx.Count);
-		Header = vector<int>(dlx.Header);
+	// 建立关系矩阵时被限制位置的积木
+	int getRestricted() const { return restricted; }
 
-		counter = dlx.counter;
+	// 建立关系矩阵时是否保留第row行
+	bool Keep(int row) const { return Block[row] != restricted || Representative[row]; }
 
-		Answer = vector<int>(dlx.Answer);
-
-		max_column = dlx.max_column;
+	// 解是否为所在等价类的代表
+	// 被限制的积木的位置在非恒等变换下不变,或解中没有用到被限制的积木时,搜索到的解不一定是代表
+	bool IsRepresentative(const vector<int>& solution) const
+	{
+		int key[PIECES], image[PIECES];
+		int n = Key(solution, 0, key);
+		for (int g = 1; g < size(); g++)
+		{
+			Key(solution, g, image);
+			if (std::lexicographical_compare(image, image + n, key, key + n))
+				return false;
+		}
+		return true;
 	}
 
-	void Link(int column, int row);
-
-	void KnownStep(int index);
-
-	void Delete(int column);
-
-	void Recover(int column);
-
-	// 广度优先遍历level_needed层,分解原始的舞蹈链数据结构为一系列较简单的舞蹈链数据结构
-	void Spread(int level, int level_needed, vector<vector<int>>& steps_list);
-
-	// 深度优先遍历,递归查找所有解
-	void Dance();
+	// 与解对称的所有解的数目,等于对称群的阶除以保持解不变的变换的数目
+	int OrbitSize(const vector<int>& solution) const
+	{
+		int key[PIECES], image[PIECES];
+		int n = Key(solution, 0, key);
+		int stabilizer = 1;
+		for (int g = 1; g < size(); g++)
+		{
+			Key(solution, g, image);
+			if (std::equal(image, image + n, key))
+				stabilizer++;
+		}
+		return size() / stabilizer;
+	}
 
-	vector<vector<int>> getResult() const
+	// 由等价类的代表求出等价类中所有的解
+	void Expand(const vector<int>& solution, vector<vector<int> >& images) const
 	{
-		return Answers;
+		vector<vector<int> > orbit;
+		for (int g = 0; g < size(); g++)
+		{
+			vector<int> image;
+			for (int row : solution)
+				image.push_back(RowMap[g][row]);
+			std::sort(image.begin(), image.end());
+			orbit.push_back(image);
+		}
+		std::sort(orbit.begin(), orbit.end());
+		orbit.erase(std::unique(orbit.begin(), orbit.end()), orbit.end());
+		images.insert(images.end(), orbit.begin(), orbit.end());
 	}
 };
 
-void DancingLinkX::Link(int row, int column)
+// 动态分解子树时接收分出的分支的任务池
+class ITaskPool
 {
-	counter++;
-	Column[counter] = column;
-	Row[counter] = row;
-	Count[column]++;
+public:
+	// 是否有线程空闲
+	virtual bool Hungry() const = 0;
+	// 把部分解steps对应的子树交给其它线程求解
+	virtual void Donate(const vector<int>& steps) = 0;
+};
 
-	Up[counter] = Up[column];
-	Down[counter] = column;
-	Down[Up[column]] = counter;
-	Up[column] = counter;
+#ifdef USING_STATS
+// 搜索树的统计数据,层数为已放置的积木数
+struct SearchStats
+{
+	long long nodes[PIECES + 1];		// 每一层的节点数
+	long long choices[PIECES + 1];		// 每一层选择位置的次数
+	long long branches[PIECES + 1];	// 每一层选中的位置的分支数之和,除以choices为平均分支数
+	long long updates;					// 舞蹈链删除节点的次数,即Knuth的updates
 
-	if (Header[row] == 0)
+	SearchStats() : updates(0)
 	{
-		Header[row] = counter;
-		Left[counter] = counter;
-		Right[counter] = counter;
+		std::fill(nodes, nodes + PIECES + 1, 0);
+		std::fill(choices, choices + PIECES + 1, 0);
+		std::fill(branches, branches + PIECES + 1, 0);
 	}
-	else
+
+	SearchStats& operator+=(const SearchStats& other)
 	{
-		Left[counter] = Left[Header[row]];
-		Right[counter] = Header[row];
-		Right[Left[Header[row]]] = counter;
-		Left[Header[row]] = counter;
+		for (int depth = 0; depth <= PIECES; depth++)
+		{
+			nodes[depth] += other.nodes[depth];
+			choices[depth] += other.choices[depth];
+			branches[depth] += other.branches[depth];
+		}
+		updates += other.updates;
+		return *this;
 	}
-}
+};
+#endif
 
-void DancingLinkX::KnownStep(int index)
+// 接收求解器搜索过的节点数,用于显示进度
+// 多个线程会同时调用AddNodes
+class IProgress
 {
-	Delete(Column[Header[index]]);
-	Answer.push_back(index);
-	for (int i = Right[Header[index]]; i != Header[index]; i = Right[i])
-		Delete(Column[i]);
-	return;
-}
+public:
+	virtual void AddNodes(long long nodes) = 0;
+};
 
-void DancingLinkX::Delete(int column)
+// 接收求解器搜索到的解
+// 多个线程会同时调用Accept
+class ISolutionSink
 {
-	Right[Left[column]] = Right[column];
-	Left[Right[column]] = Left[column];
-	for (int i = Down[column]; i != column; i = Down[i])
-		for (int j = Right[i]; j != i; j = Right[j])
-		{
-			Up[Down[j]] = Up[j];
-			Down[Up[j]] = Down[j];
-			Count[Column[j]]--;
-		}
-}
+public:
+	virtual ~ISolutionSink() {}
+	// 搜索到一个解,used为解中用到的积木,weight为这个解代表的解的数目
+	virtual void Accept(const vector<int>& solution, unsigned int used, int weight) = 0;
+};
+
+class RegionPruner;
 
-void DancingLinkX::Recover(int column)
+// 精确覆盖求解器的统一接口
+// 关系矩阵的行号从1开始,列号1--size()为图案中的位置,其后PIECES列为积木编号
+class ISolver
 {
-	for (int i = Up[column]; i != column; i = Up[i])
-		for (int j = Left[i]; j != i; j = Left[j])
-		{
-			Up[Down[j]] = j;
-			Down[Up[j]] = j;
-			Count[Column[j]]++;
-		}
-	Right[Left[column]] = column;
-	Left[Right[column]] = column;
+protected:
+	ITaskPool* pool;
+	int split_depth;
+
+	ISolutionSink* sink;
+	const Symmetry* symmetry;
+	bool expand;
+
+	IProgress* progress;
+	long long nodes;				// 搜索过的节点数,每NODE_BATCH个向progress报告一次
+	const RegionPruner* pruner;
+#ifdef USING_STATS
+	SearchStats stats;
+#endif
+
+	vector<unsigned int> RowPiece;	// 每一行用到的积木
+
+	// 进入解空间树第depth层的一个节点
+	void CountNode(int depth)
+	{
+		if ((++nodes & (NODE_BATCH - 1)) == 0 && progress != NULL)
+			progress->AddNodes(NODE_BATCH);
+#ifdef USING_STATS
+		stats.nodes[depth]++;
+#else
+		(void)depth;
+#endif
+	}
+
+	// 在第depth层选中的位置有count个分支
+	void CountBranches(int depth, int count)
+	{
+#ifdef USING_STATS
+		stats.choices[depth]++;
+		stats.branches[depth] += count;
+#else
+		(void)depth;
+		(void)count;
+#endif
+	}
+
+	// 记录第row行用到第block_index块积木
+	void LinkPiece(int row, int block_index)
+	{
+		if (row >= (int)(RowPiece.size()))
+			RowPiece.resize(row + 1, 0);
+		RowPiece[row] |= 1u << block_index;
+	}
+
+	// 把搜索到的解交给sink
+	// 依据对称性限制了积木的位置时只交出等价类的代表,需要展开时同时给出它代表的解的数目
+	void Record(const vector<int>& answer)
+	{
+		int weight = 1;
+		if (symmetry != NULL)
+		{
+			if (!symmetry->IsRepresentative(answer))
+				return;
+			if (expand)
+				weight = symmetry->OrbitSize(answer);
+		}
+		unsigned int used = 0;
+		for (int row : answer)
+			used |= RowPiece[row];
+		sink->Accept(answer, used, weight);
+	}
+
+	// 搜索到第depth层时,是否应把尚未搜索的兄弟分支分给空闲的线程
+	bool ShouldDonate(int depth) const
+	{
+		return pool != NULL && depth < split_depth && pool->Hungry();
+	}
+
+	// 把部分解answer加上row对应的子树分出去
+	void Donate(vector<int>& answer, int row)
+	{
+		answer.push_back(row);
+		pool->Donate(answer);
+		answer.pop_back();
+	}
+
+public:
+	ISolver() : pool(NULL), split_depth(0), sink(NULL), symmetry(NULL), expand(false), progress(NULL), nodes(0), pruner(NULL) {}
+	virtual ~ISolver() {}
+	// 设置动态分解子树的任务池,复制出的求解器使用同一个任务池
+	void SetTaskPool(ITaskPool* pool, int split_depth)
+	{
+		this->pool = pool;
+		this->split_depth = split_depth;
+	}
+	// 设置接收解的对象,以及建立关系矩阵时依据的对称性,复制出的求解器使用同样的设置
+	void SetSink(ISolutionSink* sink, const Symmetry* symmetry, bool expand)
+	{
+		this->sink = sink;
+		this->symmetry = symmetry;
+		this->expand = expand;
+	}
+	ISolutionSink* getSink() const { return sink; }
+	const Symmetry* getSymmetry() const { return symmetry; }
+	bool getExpand() const { return expand; }
+	// 设置接收搜索过的节点数的对象,复制出的求解器使用同一个对象
+	void SetProgress(IProgress* progress) { this->progress = progress; }
+	// 设置死区剪枝,为NULL时不剪枝,复制出的求解器使用同一个对象
+	void SetPruner(const RegionPruner* pruner) { this->pruner = pruner; }
+	// 自动分解子树时在第depth层展开了一个有count个分支的节点,与搜索中的节点一样计入统计
+	void CountSplit(int depth, int count)
+	{
+		CountNode(depth);
+		CountBranches(depth, count);
+	}
+	// 取出搜索过的节点数并清零,尚未报告的部分一并报告给progress
+	long long TakeNodes()
+	{
+		if (progress != NULL)
+			progress->AddNodes(nodes & (NODE_BATCH - 1));
+		long long total = nodes;
+		nodes = 0;
+		return total;
+	}
+#ifdef USING_STATS
+	const SearchStats& getStats() const { return stats; }
+	void SetStats(const SearchStats& stats) { this->stats = stats; }
+#endif
+	// 复制出一个状态相同的求解器,供并行求解子树使用
+	virtual ISolver* Clone() const = 0;
+	// 在关系矩阵第row行第column列放置一个1
+	virtual void Link(int row, int column) = 0;
+	// 选定第index行作为解的一部分
+	virtual void KnownStep(int index) = 0;
+	// 撤销最后一次选定的行
+	virtual void UndoStep() = 0;
+	// 当前部分解的下一层可以选定的行,已得到解或无解时为空
+	virtual void Branches(vector<int>& rows) = 0;
+	// 广度优先遍历level_needed层,分解出一系列部分解
+	virtual void Spread(int level, int level_needed, vector<vector<int>>& steps_list) = 0;
+	// 深度优先遍历,查找所有解
+	virtual void Dance() = 0;
+};
+
+// 取64位整数中最低位的1所在的位置
+inline int LowestBit(uint64_t mask)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward64(&index, mask);
+	return (int)index;
+#else
+	return __builtin_ctzll(mask);
+#endif
+}
+
+// 64位整数中1的个数
+inline int BitCount(uint64_t mask)
+{
+#if defined(_MSC_VER)
+	return (int)__popcnt64(mask);
+#else
+	return __builtin_popcountll(mask);
+#endif
+}
+
+// 取64位整数中最高位的1所在的位置
+inline int HighestBit(uint64_t mask)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse64(&index, mask);
+	return (int)index;
+#else
+	return 63 - __builtin_clzll(mask);
+#endif
+}
+
+// 由已覆盖的位置和用过的积木组成的状态的散列值
+inline uint64_t HashState(uint64_t covered, unsigned int used)
+{
+	uint64_t hash = covered * 0x9E3779B97F4A7C15ull ^ used * 0xC2B2AE3D27D4EB4Full;
+	return hash ^ (hash >> 29);
+}
+
+// 死区剪枝
+// 未覆盖的位置按相邻关系分成若干连通区域,每块积木只能放在一个区域内,每个区域都要由剩下的积木中的若干块恰好填满,
+// 有一个区域的大小不等于剩下的积木中任何几块的大小之和时,这个分支不可能有解
+// 位置用64位掩码表示,第b位为填充顺序中的第b个位置,与位棋盘算法相同;只能用于不超过64个位置的图案
+class RegionPruner
+{
+private:
+	vector<uint64_t> Bit;			// 每个位置对应的位
+	vector<uint64_t> Neighbors;	// 每一位对应的位置的相邻位置
+	vector<uint64_t> Sums;			// 每个积木集合中任意几块的大小之和,第s位为1表示可以组成s
+
+public:
+	RegionPruner(const IPattern& pattern)
+	{
+		vector<int> order = pattern.GetFillOrder();
+		Bit.resize(pattern.size() + 1, 0);
+		for (int i = 0; i < (int)(order.size()); i++)
+			Bit[order[i]] = 1ull << i;
+		vector<vector<int> > neighbors = pattern.GetNeighbors();
+		Neighbors.resize(order.size(), 0);
+		for (int i = 0; i < (int)(order.size()); i++)
+			for (int cell : neighbors[order[i]])
+				Neighbors[i] |= Bit[cell];
+
+		Sums.resize(1 << PIECES, 0);
+		Sums[0] = 1;
+		for (unsigned int pieces = 1; pieces < Sums.size(); pieces++)
+		{
+			int block_index = LowestBit(pieces);
+			int size = Piece(Shapes.shapes[block_index][0], block_index, 0).size();
+			Sums[pieces] = Sums[pieces & (pieces - 1)] | (Sums[pieces & (pieces - 1)] << size);
+		}
+	}
+
+	// 第cell个位置对应的位
+	uint64_t getBit(int cell) const { return Bit[cell]; }
+
+	// uncovered为未覆盖的位置,remaining为剩下的积木,有无法填满的区域时返回true
+	bool Dead(uint64_t uncovered, unsigned int remaining) const
+	{
+		uint64_t sums = Sums[remaining];
+		while (uncovered != 0)
+		{
+			// 从最低的未覆盖位置开始逐层扩展出它所在的区域
+			uint64_t region = uncovered & (~uncovered + 1);
+			uint64_t frontier = region;
+			while (frontier != 0)
+			{
+				uint64_t next = 0;
+				for (; frontier != 0; frontier &= frontier - 1)
+					next |= Neighbors[LowestBit(frontier)];
+				frontier = next & uncovered & ~region;
+				region |= frontier;
+			}
+			if (((sums >> BitCount(region)) & 1) == 0)
+				return true;
+			uncovered &= ~region;
+		}
+		return false;
+	}
+};
+
+// 舞蹈链节点的存储方式
+// 每个节点有左右上下四个链接,以及所在的列和行
+// 分开存储:每种数据一个数组,删除和恢复一个节点要访问四个数组
+template <class Index>
+class SeparateNodes
+{
+private:
+	vector<Index> left, right, up, down, column, row;
+
+public:
+	SeparateNodes(int node_count)
+		: left(node_count, 0), right(node_count, 0), up(node_count, 0), down(node_count, 0), column(node_count, 0), row(node_count, 0) {}
+
+	Index& Left(int i) { return left[i]; }
+	Index& Right(int i) { return right[i]; }
+	Index& Up(int i) { return up[i]; }
+	Index& Down(int i) { return down[i]; }
+	Index& Column(int i) { return column[i]; }
+	Index& Row(int i) { return row[i]; }
+};
+
+// 交错存储:一个节点的所有数据放在一起,删除和恢复一个节点只访问一处
+// 补齐为8个字段,节点不跨缓存行;Index为16位整数时每个节点占16字节
+template <class Index>
+class InterleavedNodes
+{
+private:
+	struct Node
+	{
+		Index left, right, up, down, column, row;
+		Index padding[2];
+	};
+	vector<Node> nodes;
+
+public:
+	InterleavedNodes(int node_count) : nodes(node_count, Node()) {}
+
+	Index& Left(int i) { return nodes[i].left; }
+	Index& Right(int i) { return nodes[i].right; }
+	Index& Up(int i) { return nodes[i].up; }
+	Index& Down(int i) { return nodes[i].down; }
+	Index& Column(int i) { return nodes[i].column; }
+	Index& Row(int i) { return nodes[i].row; }
+};
+
+// 舞蹈链算法实现
+// Nodes为节点的存储方式
+template <class Nodes>
+class DancingLinkX : public ISolver
+{
+private:
+	Nodes nodes;
+
+	vector<int> Count;
+	vector<int> Header;
+
+	int counter;
+
+	vector<int> Answer;
+
+	int max_column;
+	int piece_column;
+
+	// 搜索栈中的一层:选中的列,当前尝试的行(等于column时尚未选行),其后的行是否已分给其它线程
+	// 每一层放置一块积木,最多PIECES层
+	struct Frame
+	{
+		int column;
+		int row;
+		bool donated;
+	};
+	Frame Stack[PIECES];
+
+	int Left(int i) { return nodes.Left(i); }
+	int Right(int i) { return nodes.Right(i); }
+	int Up(int i) { return nodes.Up(i); }
+	int Down(int i) { return nodes.Down(i); }
+	int Column(int i) { return nodes.Column(i); }
+	int Row(int i) { return nodes.Row(i); }
+
+	// 深度优先遍历,steps_list不为NULL时只遍历depth_needed层并记录部分解
+	void Search(int depth_needed, vector<vector<int> >* steps_list);
+
+	// 由链表中剩下的列得到未覆盖的位置和剩下的积木,交给pruner检查
+	bool Dead()
+	{
+		uint64_t uncovered = 0;
+		unsigned int remaining = 0;
+		for (int i = Right(0); i != 0; i = Right(i))
+			if (i < piece_column)
+				uncovered |= pruner->getBit(i);
+			else
+				remaining |= 1u << (i - piece_column);
+		return pruner->Dead(uncovered, remaining);
+	}
+
+public:
+	// 构造函数
+	DancingLinkX(int node_count, int row_count, int column_count, bool isComplete) : nodes(node_count)
+	{
+		Count.resize(column_count + 1, 0);
+		Header.resize(row_count + 1, 0);
+
+		max_column = isComplete ? column_count : column_count - PIECES;
+		piece_column = column_count - PIECES + 1;
+		Answer.reserve(PIECES);
+
+		for (int i = 0; i <= column_count; i++)
+		{
+			nodes.Left(i) = i == 0 ? column_count : i - 1;
+			nodes.Right(i) = i == column_count ? 0 : i + 1;
+			nodes.Up(i) = i;
+			nodes.Down(i) = i;
+
+			nodes.Column(i) = i;
+			nodes.Row(i) = 0;
+
+			Count[i] = 0;
+		}
+		counter = column_count;
+	}
+
+	ISolver* Clone() const { return new DancingLinkX(*this); }
+
+	void Link(int row, int column);
+
+	void KnownStep(int index);
+
+	void UndoStep();
+
+	void Branches(vector<int>& rows);
+
+	void Delete(int column);
+
+	void Recover(int column);
+
+	// 广度优先遍历level_needed层,分解原始的舞蹈链数据结构为一系列较简单的舞蹈链数据结构
+	void Spread(int level, int level_needed, vector<vector<int>>& steps_list);
+
+	// 深度优先遍历,查找所有解
+	void Dance();
+};
+
+template <class Nodes>
+void DancingLinkX<Nodes>::Link(int row, int column)
+{
+	if (column >= piece_column)
+		LinkPiece(row, column - piece_column);
+
+	counter++;
+	nodes.Column(counter) = column;
+	nodes.Row(counter) = row;
+	Count[column]++;
+
+	nodes.Up(counter) = Up(column);
+	nodes.Down(counter) = column;
+	nodes.Down(Up(column)) = counter;
+	nodes.Up(column) = counter;
+
+	if (Header[row] == 0)
+	{
+		Header[row] = counter;
+		nodes.Left(counter) = counter;
+		nodes.Right(counter) = counter;
+	}
+	else
+	{
+		nodes.Left(counter) = Left(Header[row]);
+		nodes.Right(counter) = Header[row];
+		nodes.Right(Left(Header[row])) = counter;
+		nodes.Left(Header[row]) = counter;
+	}
+}
+
+template <class Nodes>
+void DancingLinkX<Nodes>::KnownStep(int index)
+{
+	Delete(Column(Header[index]));
+	Answer.push_back(index);
+	for (int i = Right(Header[index]); i != Header[index]; i = Right(i))
+		Delete(Column(i));
+	return;
+}
+
+template <class Nodes>
+void DancingLinkX<Nodes>::UndoStep()
+{
+	int index = Answer.back();
+	Answer.pop_back();
+	for (int i = Left(Header[index]); i != Header[index]; i = Left(i))
+		Recover(Column(i));
+	Recover(Column(Header[index]));
+}
+
+template <class Nodes>
+void DancingLinkX<Nodes>::Branches(vector<int>& rows)
+{
+	rows.clear();
+	int now = Right(0);
+	if (now == 0 || now > max_column)
+		return;
+	int least_count = INT_MAX;
+	for (int i = Right(0); i != 0 && i <= max_column; i = Right(i))
+		if (Count[i] < least_count)
+		{
+			least_count = Count[i];
+			now = i;
+		}
+	for (int i = Down(now); i != now; i = Down(i))
+		rows.push_back(Row(i));
+}
+
+template <class Nodes>
+void DancingLinkX<Nodes>::Delete(int column)
+{
+	nodes.Right(Left(column)) = Right(column);
+	nodes.Left(Right(column)) = Left(column);
+	for (int i = Down(column); i != column; i = Down(i))
+		for (int j = Right(i); j != i; j = Right(j))
+		{
+			nodes.Up(Down(j)) = Up(j);
+			nodes.Down(Up(j)) = Down(j);
+			Count[Column(j)]--;
+#ifdef USING_STATS
+			stats.updates++;
+#endif
+		}
+}
+
+template <class Nodes>
+void DancingLinkX<Nodes>::Recover(int column)
+{
+	for (int i = Up(column); i != column; i = Up(i))
+		for (int j = Left(i); j != i; j = Left(j))
+		{
+			nodes.Up(Down(j)) = j;
+			nodes.Down(Up(j)) = j;
+			Count[Column(j)]++;
+		}
+	nodes.Right(Left(column)) = column;
+	nodes.Left(Right(column)) = column;
+}
+
+template <class Nodes>
+void DancingLinkX<Nodes>::Spread(int level, int level_needed, vector<vector<int>>& steps_list)
+{
+	Search(level_needed - level, &steps_list);
+}
+
+template <class Nodes>
+void DancingLinkX<Nodes>::Dance()
+{
+	Search(PIECES, NULL);
+}
+
+// 不用递归,每一层选中的列和当前尝试的行保存在Stack中
+template <class Nodes>
+void DancingLinkX<Nodes>::Search(int depth_needed, vector<vector<int> >* steps_list)
+{
+	int depth = 0;
+	for (;;)
+	{
+		// 进入新的一层;展开时记录下的部分解是子树的根,在求解子树时计数
+		if (steps_list == NULL || depth < depth_needed)
+			CountNode((int)(Answer.size()));
+		int now = Right(0);
+		if (now == 0 || now > max_column)
+			Record(Answer);
+		else if (steps_list != NULL && depth == depth_needed)
+			steps_list->push_back(Answer);
+		else if (pruner != NULL && Dead())
+			;	// 剩下的位置中有无法填满的区域,不再向下搜索
+		else
+		{
+			int least_count = INT_MAX;
+			for (int i = Right(0); i != 0 && i <= max_column; i = Right(i))
+				if (Count[i] < least_count)
+				{
+					least_count = Count[i];
+					now = i;
+				}
+			CountBranches((int)(Answer.size()), least_count);
+			Delete(now);
+			Stack[depth].column = now;
+			Stack[depth].row = now;
+			Stack[depth].donated = false;
+			depth++;
+		}
+
+		// 撤销栈顶一层当前的行,改为尝试下一行;这一层的行都已尝试过时回溯到上一层
+		for (;;)
+		{
+			if (depth == 0)
+				return;
+			Frame& frame = Stack[depth - 1];
+			int i = frame.row;
+			if (i != frame.column)
+			{
+				for (int j = Left(i); j != i; j = Left(j))
+					Recover(Column(j));
+				Answer.pop_back();
+			}
+			i = frame.donated ? frame.column : Down(i);
+			if (i == frame.column)
+			{
+				Recover(frame.column);
+				depth--;
+				continue;
+			}
+
+			// 有线程空闲时,其后的分支交给其它线程,这里只搜索当前分支
+			if (Down(i) != frame.column && ShouldDonate((int)(Answer.size())))
+			{
+				for (int j = Down(i); j != frame.column; j = Down(j))
+					Donate(Answer, Row(j));
+				frame.donated = true;
+			}
+
+			frame.row = i;
+			Answer.push_back(Row(i));
+			for (int j = Right(i); j != i; j = Right(j))
+				Delete(Column(j));
+			break;
+		}
+	}
+}
+
+// 按指定的节点存储方式创建舞蹈链
+// compact为16位整数交错存储,节点或行超过16位整数的范围时改用int
+ISolver* CreateDancingLinkX(const string& layout, int node_count, int row_count, int column_count, bool isComplete)
+{
+	if (layout == "separate")
+		return new DancingLinkX<SeparateNodes<int> >(node_count, row_count, column_count, isComplete);
+	if (layout == "compact" && node_count <= 0x10000 && row_count < 0x10000)
+		return new DancingLinkX<InterleavedNodes<uint16_t> >(node_count, row_count, column_count, isComplete);
+	return new DancingLinkX<InterleavedNodes<int> >(node_count, row_count, column_count, isComplete);
+}
+
+// 位棋盘算法实现
+// 图案最多64个位置,每行占据的位置用一个64位整数表示,积木编号用另一个整数表示
+// 位置按图案给出的填充顺序依次对应整数的各个位
+// 所有的行按占据的最低位分组,每次总是填充最低位的空位置,不需要在链表间来回跳转
+class BitboardSolver : public ISolver
+{
+protected:
+	// 关系矩阵中的一行
+	struct Placement
+	{
+		uint64_t cells;
+		unsigned int piece;
+		int row;
+	};
+
+	int cell_count;
+	uint64_t full;
+
+	// 位置编号对应的位
+	vector<int> Bit;
+
+	vector<uint64_t> RowCells;
+
+	// 按最小位置分组后连续存放的所有行,First[i]为最小位置为i的第一行
+	vector<Placement> Placements;
+	vector<int> First;
+
+	uint64_t covered;
+	unsigned int used;
+
+	vector<int> Answer;
+
+	// 按最小位置对所有行分组
+	void Index();
+
+	void Search(uint64_t covered, unsigned int used);
+
+public:
+	// order为位置的填充顺序
+	BitboardSolver(int row_count, const vector<int>& order) : cell_count((int)(order.size())), covered(0), used(0)
+	{
+		full = cell_count == 64 ? ~0ull : (1ull << cell_count) - 1;
+		Bit.resize(cell_count + 1, 0);
+		for (int i = 0; i < cell_count; i++)
+			Bit[order[i]] = i;
+		RowCells.resize(row_count + 1, 0);
+		RowPiece.resize(row_count + 1, 0);
+		Answer.reserve(PIECES);
+	}
+
+	ISolver* Clone() const { return new BitboardSolver(*this); }
+
+	void Link(int row, int column);
+
+	void KnownStep(int index);
+
+	void UndoStep();
+
+	void Branches(vector<int>& rows);
+
+	void Spread(int level, int level_needed, vector<vector<int>>& steps_list);
+
+	void Dance();
+};
+
+void BitboardSolver::Link(int row, int column)
+{
+	if (column <= cell_count)
+		RowCells[row] |= 1ull << Bit[column];
+	else
+		LinkPiece(row, column - cell_count - 1);
+	First.clear();
+}
+
+void BitboardSolver::Index()
+{
+	Placements.clear();
+	First.assign(cell_count + 1, 0);
+	for (int row = 1; row < (int)(RowCells.size()); row++)
+		if (RowCells[row] != 0)
+			First[LowestBit(RowCells[row]) + 1]++;
+	for (int i = 0; i < cell_count; i++)
+		First[i + 1] += First[i];
+
+	Placements.resize(First[cell_count]);
+	vector<int> next(First.begin(), First.end() - 1);
+	for (int row = 1; row < (int)(RowCells.size()); row++)
+		if (RowCells[row] != 0)
+		{
+			Placement& placement = Placements[next[LowestBit(RowCells[row])]++];
+			placement.cells = RowCells[row];
+			placement.piece = RowPiece[row];
+			placement.row = row;
+		}
+}
+
+void BitboardSolver::KnownStep(int index)
+{
+	covered |= RowCells[index];
+	used |= RowPiece[index];
+	Answer.push_back(index);
+}
+
+void BitboardSolver::UndoStep()
+{
+	covered &= ~RowCells[Answer.back()];
+	used &= ~RowPiece[Answer.back()];
+	Answer.pop_back();
+}
+
+void BitboardSolver::Branches(vector<int>& rows)
+{
+	rows.clear();
+	if (First.empty())
+		Index();
+	if (covered == full)
+		return;
+	int cell = LowestBit(~covered);
+	for (int i = First[cell]; i < First[cell + 1]; i++)
+		if ((Placements[i].cells & covered) == 0 && (Placements[i].piece & used) == 0)
+			rows.push_back(Placements[i].row);
+}
+
+void BitboardSolver::Spread(int level, int level_needed, vector<vector<int>>& steps_list)
+{
+	if (First.empty())
+		Index();
+	if (level >= level_needed || covered == full)
+	{
+		steps_list.push_back(Answer);
+		return;
+	}
+	CountNode((int)(Answer.size()));
+	uint64_t old_covered = covered;
+	unsigned int old_used = used;
+	int cell = LowestBit(~covered);
+	for (int i = First[cell]; i < First[cell + 1]; i++)
+	{
+		const Placement& placement = Placements[i];
+		if ((placement.cells & old_covered) != 0 || (placement.piece & old_used) != 0)
+			continue;
+		covered = old_covered | placement.cells;
+		used = old_used | placement.piece;
+		Answer.push_back(placement.row);
+
+		Spread(level + 1, level_needed, steps_list);
+
+		Answer.pop_back();
+	}
+	covered = old_covered;
+	used = old_used;
+}
+
+void BitboardSolver::Dance()
+{
+	if (First.empty())
+		Index();
+	Search(covered, used);
+}
+
+void BitboardSolver::Search(uint64_t covered, unsigned int used)
+{
+	CountNode((int)(Answer.size()));
+	if (covered == full)
+	{
+		Record(Answer);
+		return;
+	}
+	if (pruner != NULL && pruner->Dead(full & ~covered, ~used & ((1u << PIECES) - 1)))
+		return;
+	int cell = LowestBit(~covered);
+	const Placement* end = Placements.data() + First[cell + 1];
+#ifdef USING_STATS
+	int count = 0;
+	for (const Placement* placement = Placements.data() + First[cell]; placement != end; placement++)
+		if ((placement->cells & covered) == 0 && (placement->piece & used) == 0)
+			count++;
+	CountBranches((int)(Answer.size()), count);
+#endif
+	for (const Placement* placement = Placements.data() + First[cell]; placement != end; placement++)
+	{
+		if ((placement->cells & covered) != 0 || (placement->piece & used) != 0)
+			continue;
+
+		// 有线程空闲时,其后的分支交给其它线程,这里只搜索当前分支
+		bool donated = ShouldDonate((int)(Answer.size()));
+		if (donated)
+			for (const Placement* sibling = placement + 1; sibling != end; sibling++)
+				if ((sibling->cells & covered) == 0 && (sibling->piece & used) == 0)
+					Donate(Answer, sibling->row);
+
+		Answer.push_back(placement->row);
+		Search(covered | placement->cells, used | placement->piece);
+		Answer.pop_back();
+
+		if (donated)
+			break;
+	}
+}
+
+// 只计数时的置换表,以已覆盖的位置和用过的积木为键记住一个状态下解的数目
+// 大小固定,每个键只能放在相邻的两个位置之一,都被其它键占用时替换求出时搜索节点较少的一项
+// 各线程共用一个置换表,按位置分段加锁
+class TranspositionTable
+{
+private:
+	struct Entry
+	{
+		uint64_t covered;
+		unsigned int used;
+		unsigned int cost;		// 求出这一项时搜索的节点数,0表示空
+		long long count;
+	};
+	vector<Entry> entries;
+	uint64_t mask;
+#ifdef USING_TBB
+	static const int LOCKS = 1024;
+	vector<tbb::spin_mutex> locks;
+#endif
+
+	// 键对应的两个位置中的第一个
+	uint64_t Bucket(uint64_t covered, unsigned int used) const
+	{
+		return HashState(covered, used) & mask & ~1ull;
+	}
+
+public:
+	// megabytes为置换表占用的内存,取不超过它的2的幂个项
+	TranspositionTable(int megabytes)
+#ifdef USING_TBB
+		: locks(LOCKS)
+#endif
+	{
+		uint64_t size = 2;
+		while (size * 2 * sizeof(Entry) <= (uint64_t)megabytes << 20)
+			size *= 2;
+		entries.assign(size, Entry());
+		mask = size - 1;
+	}
+
+	uint64_t size() const { return entries.size(); }
+
+	bool Find(uint64_t covered, unsigned int used, long long& count)
+	{
+		uint64_t bucket = Bucket(covered, used);
+#ifdef USING_TBB
+		tbb::spin_mutex::scoped_lock lock(locks[(bucket >> 1) & (LOCKS - 1)]);
+#endif
+		for (uint64_t i = bucket; i <= bucket + 1; i++)
+			if (entries[i].cost != 0 && entries[i].covered == covered && entries[i].used == used)
+			{
+				count = entries[i].count;
+				return true;
+			}
+		return false;
+	}
+
+	void Store(uint64_t covered, unsigned int used, long long count, long long cost)
+	{
+		uint64_t bucket = Bucket(covered, used);
+#ifdef USING_TBB
+		tbb::spin_mutex::scoped_lock lock(locks[(bucket >> 1) & (LOCKS - 1)]);
+#endif
+		uint64_t slot = entries[bucket].cost <= entries[bucket + 1].cost ? bucket : bucket + 1;
+		for (uint64_t i = bucket; i <= bucket + 1; i++)
+			if (entries[i].cost != 0 && entries[i].covered == covered && entries[i].used == used)
+				slot = i;
+		entries[slot].covered = covered;
+		entries[slot].used = used;
+		entries[slot].cost = (unsigned int)((std::min)(cost, (long long)UINT_MAX));
+		entries[slot].count = count;
+	}
+};
+
+// ZDD算法实现(Knuth的DXZ)
+// 在位棋盘算法的基础上,以已覆盖的位置和用过的积木为键记住每个状态下所有的解组成的集合族,同样的状态只求解一次
+// 集合族表示为零压缩决策图(ZDD):节点(row, lo, hi)表示选定第row行再接hi中的解,或者不选这一行而取lo中的解
+// 只计数时直接由ZDD中的数目得出;给出置换表时不建立ZDD,只在置换表中记住解的数目
+class ZddSolver : public BitboardSolver
+{
+private:
+	static const int ZDD_BOTTOM = 0;	// 空集族,无解
+	static const int ZDD_TOP = 1;		// 只含空集的集族,已得到解
+
+	struct ZddNode
+	{
+		int row;
+		int lo;
+		int hi;
+	};
+
+	// 记住的一个状态,node为-1表示空
+	struct State
+	{
+		uint64_t covered;
+		unsigned int used;
+		int node;
+	};
+
+	bool isComplete;
+	bool count_only;
+	TranspositionTable* table;
+
+	vector<ZddNode> Diagram;
+	vector<long long> Counts;		// 每个节点表示的解的数目
+
+	// 记住的状态,大小固定,每个状态只能放在一个位置,冲突时替换;被替换的状态再遇到时重新建立,不影响结果
+	// 每个线程的求解器各有一份,第一次求解时分配2的memo_bits次幂个,memo_bits为-1时不记住状态
+	vector<State> Memo;
+	int memo_bits;
+	size_t states;
+
+	// 被替换的状态的子图不会再用到,却仍留在Diagram中;
+	// 两次求解之间,ZDD的节点数超过记住的状态数目时清空ZDD和记住的状态,使节点数不会无限增长
+	void Trim()
+	{
+		size_t limit = memo_bits < 0 ? 0 : (size_t)1 << memo_bits;
+		if (Diagram.size() - 2 <= limit)
+			return;
+		Diagram.resize(2);
+		Counts.resize(2);
+		std::fill(Memo.begin(), Memo.end(), State{ 0, 0, -1 });
+		states = 0;
+	}
+
+	// 建立covered和used状态下所有解的ZDD,返回其根节点
+	int Build(uint64_t covered, unsigned int used);
+
+	// 用置换表计算covered和used状态下解的数目
+	long long Count(uint64_t covered, unsigned int used);
+
+	// 把node中的每个解接在当前部分解之后交给sink
+	void Enumerate(int node);
+
+public:
+	ZddSolver(int row_count, const vector<int>& order, bool isComplete)
+		: BitboardSolver(row_count, order), isComplete(isComplete), count_only(false), table(NULL), memo_bits(ZDD_MEMO_BITS), states(0)
+	{
+		Diagram.resize(2, ZddNode());
+		Counts.push_back(0);
+		Counts.push_back(1);
+	}
+
+	ISolver* Clone() const { return new ZddSolver(*this); }
+
+	// 只计数时不必枚举每个解;table不为NULL时用置换表计数,复制出的求解器使用同一个置换表
+	void SetCounting(bool count_only, TranspositionTable* table)
+	{
+		this->count_only = count_only;
+		this->table = table;
+	}
+
+	// 每个线程记住的状态占megabytes MB,向下取整到2的幂,为0时不记住状态;在复制求解器之前设置
+	void SetMemo(int megabytes)
+	{
+		memo_bits = -1;
+		for (int bits = 0; bits < 40 && ((long long)(megabytes) << 20) >= (long long)(sizeof(State)) << bits; bits++)
+			memo_bits = bits;
+		Memo.clear();
+	}
+
+	// ZDD的节点数和记住的状态数
+	size_t NodeCount() const { return Diagram.size(); }
+	size_t StateCount() const { return states; }
+
+	void Dance();
+
+	// 建立当前部分解之后所有解的ZDD,均匀地随机抽取sample_count个解交给sink,返回解的总数
+	long long Sample(int sample_count, std::mt19937_64& random);
+};
+
+int ZddSolver::Build(uint64_t covered, unsigned int used)
+{
+	if (covered == full)
+		return ZDD_TOP;
+	if (Memo.empty() && memo_bits >= 0)
+		Memo.resize((size_t)1 << memo_bits, State{ 0, 0, -1 });
+	size_t slot = memo_bits < 0 ? 0 : (size_t)(HashState(covered, used) & (((uint64_t)1 << memo_bits) - 1));
+	if (memo_bits >= 0 && Memo[slot].node >= 0 && Memo[slot].covered == covered && Memo[slot].used == used)
+		return Memo[slot].node;
+
+	CountNode(BitCount(used));
+	int result = ZDD_BOTTOM;
+	if (pruner == NULL || !pruner->Dead(full & ~covered, ~used & ((1u << PIECES) - 1)))
+	{
+		// 从后向前接到lo上,沿lo链的各行与位棋盘算法的分支顺序相同
+		int cell = LowestBit(~covered);
+		for (int i = First[cell + 1] - 1; i >= First[cell]; i--)
+		{
+			const Placement& placement = Placements[i];
+			if ((placement.cells & covered) != 0 || (placement.piece & used) != 0)
+				continue;
+			int hi = Build(covered | placement.cells, used | placement.piece);
+			if (hi == ZDD_BOTTOM)
+				continue;
+			ZddNode node = { placement.row, result, hi };
+			Diagram.push_back(node);
+			Counts.push_back(Counts[result] + Counts[hi]);
+			result = (int)(Diagram.size()) - 1;
+		}
+	}
+	if (memo_bits < 0)
+		return result;
+	if (Memo[slot].node < 0)
+		states++;
+	Memo[slot].covered = covered;
+	Memo[slot].used = used;
+	Memo[slot].node = result;
+	return result;
+}
+
+long long ZddSolver::Count(uint64_t covered, unsigned int used)
+{
+	if (covered == full)
+		return 1;
+	long long count = 0;
+	if (table->Find(covered, used, count))
+		return count;
+
+	long long before = nodes;
+	CountNode(BitCount(used));
+	if (pruner == NULL || !pruner->Dead(full & ~covered, ~used & ((1u << PIECES) - 1)))
+	{
+		int cell = LowestBit(~covered);
+		for (int i = First[cell]; i < First[cell + 1]; i++)
+		{
+			const Placement& placement = Placements[i];
+			if ((placement.cells & covered) == 0 && (placement.piece & used) == 0)
+				count += Count(covered | placement.cells, used | placement.piece);
+		}
+	}
+	table->Store(covered, used, count, nodes - before);
+	return count;
+}
+
+void ZddSolver::Enumerate(int node)
+{
+	for (; node != ZDD_BOTTOM; node = Diagram[node].lo)
+	{
+		if (node == ZDD_TOP)
+		{
+			Record(Answer);
+			return;
+		}
+		Answer.push_back(Diagram[node].row);
+		Enumerate(Diagram[node].hi);
+		Answer.pop_back();
+	}
+}
+
+void ZddSolver::Dance()
+{
+	if (First.empty())
+		Index();
+	Trim();
+
+	// 解都用到全部积木且不需要按对称性筛选时,只交出数目
+	if (count_only && symmetry == NULL && isComplete)
+	{
+		long long count = table != NULL ? Count(covered, used) : Counts[Build(covered, used)];
+		for (; count > INT_MAX; count -= INT_MAX)
+			sink->Accept(Answer, (1u << PIECES) - 1, INT_MAX);
+		if (count > 0)
+			sink->Accept(Answer, (1u << PIECES) - 1, (int)count);
+		return;
+	}
+	Enumerate(Build(covered, used));
+}
+
+long long ZddSolver::Sample(int sample_count, std::mt19937_64& random)
+{
+	if (First.empty())
+		Index();
+	Trim();
+	int root = Build(covered, used);
+	long long total = Counts[root];
+	for (int k = 0; k < sample_count && total > 0; k++)
+	{
+		// 在[0, total)中取一个序号,沿ZDD找出这个序号的解
+		long long index = std::uniform_int_distribution<long long>(0, total - 1)(random);
+		size_t prefix = Answer.size();
+		for (int node = root; node != ZDD_TOP;)
+		{
+			if (index < Counts[Diagram[node].hi])
+			{
+				Answer.push_back(Diagram[node].row);
+				node = Diagram[node].hi;
+			}
+			else
+			{
+				index -= Counts[Diagram[node].hi];
+				node = Diagram[node].lo;
+			}
+		}
+		Record(Answer);
+		Answer.resize(prefix);
+	}
+	return total;
+}
+
+// 折半搜索实现
+// 按填充顺序把图案分成前cut个位置和其余位置两半:
+// 前一半按填充顺序覆盖前一半的所有位置,积木可以越过分界,记下越过分界覆盖的位置和用过的积木;
+// 后一半从最后一个位置倒序处理,每个位置或者由完全在后一半的积木覆盖,或者留给越过分界的积木,记下留出的位置和用过的积木
+// 越过分界覆盖的位置与留出的位置相同、用过的积木互补时拼成一个解,用散列表连接
+// 只适用于用到全部积木的图案,其它图案按位棋盘算法求解
+// 求得的解交给sink时要在求解子树的线程中,连接不并行
+class MeetInTheMiddle : public BitboardSolver
+{
+private:
+	// 一半中的一个部分解,这一半选定的行存放在Rows中从offset开始的count个
+	struct Half
+	{
+		uint64_t cells;
+		unsigned int used;
+		int offset;
+		int count;
+	};
+
+	struct HalfKey
+	{
+		uint64_t cells;
+		unsigned int used;
+		bool operator==(const HalfKey& other) const { return cells == other.cells && used == other.used; }
+	};
+
+	struct HalfKeyHash
+	{
+		size_t operator()(const HalfKey& key) const { return (size_t)HashState(key.cells, key.used); }
+	};
+
+	int cut;
+	bool isComplete;
+	bool count_only;
+
+	uint64_t right;			// 后一半的位置
+	uint64_t reachable;		// 越过分界的积木可能覆盖的后一半的位置
+
+	// 完全在后一半的行,按最高位置分组,Last[i]为最高位置为i的第一行
+	vector<Placement> RightPlacements;
+	vector<int> Last;
+
+	vector<Half> Lefts, Rights;
+	vector<int> LeftRows, RightRows;
+	size_t prefix;			// 开始折半搜索时已选定的行数
+
+	// 找出后一半的行和越过分界的积木可能覆盖的位置
+	void IndexRight();
+
+	void EnumerateLeft(uint64_t covered, unsigned int used);
+
+	// decided为已覆盖或留出的位置,skipped为留出的位置,base为折半搜索之前用过的积木
+	void EnumerateRight(uint64_t decided, uint64_t skipped, unsigned int used, unsigned int base);
+
+	// 记下Answer中已选定的行之后的部分解
+	void Keep(vector<Half>& halves, vector<int>& rows, uint64_t cells, unsigned int used);
+
+public:
+	// cut为前一半的位置数目
+	MeetInTheMiddle(int row_count, const vector<int>& order, bool isComplete, int cut)
+		: BitboardSolver(row_count, order), isComplete(isComplete), count_only(false), right(0), reachable(0), prefix(0)
+	{
+		this->cut = (std::max)(1, (std::min)(cut, cell_count - 1));
+	}
+
+	ISolver* Clone() const { return new MeetInTheMiddle(*this); }
+
+	// 只计数时不必拼出每个解
+	void SetCounting(bool count_only) { this->count_only = count_only; }
+
+	void Dance();
+};
+
+void MeetInTheMiddle::IndexRight()
+{
+	right = full & ~((1ull << cut) - 1);
+	reachable = 0;
+	Last.assign(cell_count + 1, 0);
+	for (const Placement& placement : Placements)
+		if ((placement.cells & ~right) == 0)
+			Last[HighestBit(placement.cells) + 1]++;
+		else
+			reachable |= placement.cells & right;
+	for (int i = 0; i < cell_count; i++)
+		Last[i + 1] += Last[i];
+
+	RightPlacements.resize(Last[cell_count]);
+	vector<int> next(Last.begin(), Last.end() - 1);
+	for (const Placement& placement : Placements)
+		if ((placement.cells & ~right) == 0)
+			RightPlacements[next[HighestBit(placement.cells)]++] = placement;
+}
+
+void MeetInTheMiddle::Keep(vector<Half>& halves, vector<int>& rows, uint64_t cells, unsigned int used)
+{
+	// 只计数时不保存行
+	Half half = { cells, used, (int)(rows.size()), 0 };
+	if (!count_only || symmetry != NULL)
+	{
+		half.count = (int)(Answer.size() - prefix);
+		rows.insert(rows.end(), Answer.begin() + prefix, Answer.end());
+	}
+	halves.push_back(half);
+}
+
+void MeetInTheMiddle::EnumerateLeft(uint64_t covered, unsigned int used)
+{
+	CountNode((int)(Answer.size()));
+	if ((covered | right) == full)
+	{
+		Keep(Lefts, LeftRows, covered & right, used);
+		return;
+	}
+	int cell = LowestBit(~covered);
+	for (int i = First[cell]; i < First[cell + 1]; i++)
+	{
+		const Placement& placement = Placements[i];
+		if ((placement.cells & covered) != 0 || (placement.piece & used) != 0)
+			continue;
+		Answer.push_back(placement.row);
+		EnumerateLeft(covered | placement.cells, used | placement.piece);
+		Answer.pop_back();
+	}
+}
+
+void MeetInTheMiddle::EnumerateRight(uint64_t decided, uint64_t skipped, unsigned int used, unsigned int base)
+{
+	CountNode((int)(Answer.size()));
+	uint64_t open = right & ~decided;
+	if (open == 0)
+	{
+		Keep(Rights, RightRows, skipped, used & ~base);
+		return;
+	}
+	int cell = HighestBit(open);
+	for (int i = Last[cell]; i < Last[cell + 1]; i++)
+	{
+		const Placement& placement = RightPlacements[i];
+		if ((placement.cells & decided) != 0 || (placement.piece & used) != 0)
+			continue;
+		Answer.push_back(placement.row);
+		EnumerateRight(decided | placement.cells, skipped, used | placement.piece, base);
+		Answer.pop_back();
+	}
+	if ((reachable >> cell) & 1)
+		EnumerateRight(decided | (1ull << cell), skipped | (1ull << cell), used, base);
+}
+
+void MeetInTheMiddle::Dance()
+{
+	if (First.empty())
+		Index();
+	if (!isComplete)
+	{
+		BitboardSolver::Dance();
+		return;
+	}
+	if (Last.empty())
+		IndexRight();
+
+	// 两半分别枚举;已选定的行覆盖的后一半的位置当作留出的位置
+	prefix = Answer.size();
+	Lefts.clear();
+	LeftRows.clear();
+	Rights.clear();
+	RightRows.clear();
+	EnumerateLeft(covered, used);
+	EnumerateRight(covered & right, covered & right, used, used);
+
+	// 前一半按键排序,每个键对应一段,建立散列表
+	std::sort(Lefts.begin(), Lefts.end(), [](const Half& half1, const Half& half2) {
+		return half1.cells != half2.cells ? half1.cells < half2.cells : half1.used < half2.used;
+	});
+	std::unordered_map<HalfKey, pair<int, int>, HalfKeyHash> index;
+	for (int begin = 0, end = 0; begin < (int)(Lefts.size()); begin = end)
+	{
+		for (end = begin + 1; end < (int)(Lefts.size()) && Lefts[end].cells == Lefts[begin].cells && Lefts[end].used == Lefts[begin].used; end++)
+			;
+		HalfKey key = { Lefts[begin].cells, Lefts[begin].used };
+		index[key] = pair<int, int>(begin, end);
+	}
+
+	// 后一半逐个查找留出的位置相同、积木互补的前一半
+	unsigned int all = (1u << PIECES) - 1;
+	vector<int> solution(Answer.begin(), Answer.end());
+	for (const Half& half : Rights)
+	{
+		HalfKey key = { half.cells, all & ~half.used };
+		auto found = index.find(key);
+		if (found == index.end())
+			continue;
+		if (count_only && symmetry == NULL)
+		{
+			sink->Accept(Answer, all, found->second.second - found->second.first);
+			continue;
+		}
+		for (int l = found->second.first; l < found->second.second; l++)
+		{
+			const Half& left = Lefts[l];
+			solution.resize(prefix);
+			solution.insert(solution.end(), LeftRows.begin() + left.offset, LeftRows.begin() + left.offset + left.count);
+			solution.insert(solution.end(), RightRows.begin() + half.offset, RightRows.begin() + half.offset + half.count);
+			Record(solution);
+		}
+	}
+}
+
+// 舞蹈格算法实现(Knuth的稀疏集合精确覆盖)
+// 每一列的行连续存放在Set中的一段,前size个仍然可用;删除一行时与最后一个可用的行交换位置,size减一,
+// 撤销时按相反的顺序把size加一即可恢复,不需要修改任何链接
+// 尚未覆盖的主列也是一个稀疏集合,每次选择可用行最少的列
+class DancingCells : public ISolver
+{
+private:
+	// 关系矩阵中的一个1,所有行的节点按行连续存放
+	// first和end为所在的行的节点范围,搜索时不必再查找行
+	struct Node
+	{
+		int column;
+		int where;		// 在Set中的位置
+		int first;
+		int end;
+	};
+
+	// 一列的节点存放在Set中从start开始的一段
+	struct ColumnSet
+	{
+		int start;
+		int size;
+	};
+
+	int column_count;
+	int max_column;
+	int piece_column;
+
+	// 建立关系矩阵时每一行的列,整理后不再使用
+	vector<vector<int> > RowColumns;
+
+	// RowStart[r]为第r行的第一个节点,NodeRow为每个节点所在的行
+	vector<int> RowStart;
+	vector<Node> Nodes;
+	vector<int> NodeRow;
+	vector<ColumnSet> Columns;
+	vector<int> Set;
+
+	// 尚未覆盖的主列,前active个可用,Position为每一列在Active中的位置
+	// Origin为覆盖时列在Active中原来的位置,撤销时放回原处,使Active的顺序不受之前搜索的影响
+	vector<int> Active;
+	vector<int> Position;
+	vector<int> Origin;
+	int active;
+
+	vector<int> Answer;
+
+	// 由每一行的列整理出连续存放的节点和列的集合
+	void Index();
+
+	// 覆盖第column列:从其它列中删去包含这一列的所有行
+	void Cover(int column);
+
+	// 按相反的顺序撤销Cover
+	void Uncover(int column);
+
+	// 可用行最少的列
+	int Choose(int& least_count) const;
+
+	// 由尚未覆盖的列和已选定的行得到未覆盖的位置和剩下的积木,交给pruner检查
+	bool Dead() const;
+
+	// 深度优先遍历,steps_list不为NULL时只遍历depth_needed层并记录部分解
+	void Search(int depth, int depth_needed, vector<vector<int> >* steps_list);
+
+public:
+	DancingCells(int row_count, int column_count, bool isComplete) : column_count(column_count), active(0)
+	{
+		max_column = isComplete ? column_count : column_count - PIECES;
+		piece_column = column_count - PIECES + 1;
+		RowColumns.resize(row_count + 1);
+		RowPiece.resize(row_count + 1, 0);
+		Answer.reserve(PIECES);
+	}
+
+	ISolver* Clone() const { return new DancingCells(*this); }
+
+	void Link(int row, int column);
+
+	void KnownStep(int index);
+
+	void UndoStep();
+
+	void Branches(vector<int>& rows);
+
+	void Spread(int level, int level_needed, vector<vector<int>>& steps_list);
+
+	void Dance();
+};
+
+void DancingCells::Link(int row, int column)
+{
+	if (column >= piece_column)
+		LinkPiece(row, column - piece_column);
+	RowColumns[row].push_back(column);
+	RowStart.clear();
+}
+
+void DancingCells::Index()
+{
+	int row_count = (int)(RowColumns.size()) - 1;
+	RowStart.assign(row_count + 2, 0);
+	for (int row = 1; row <= row_count; row++)
+		RowStart[row + 1] = RowStart[row] + (int)(RowColumns[row].size());
+	Nodes.resize(RowStart[row_count + 1]);
+	NodeRow.resize(Nodes.size());
+	Set.resize(Nodes.size());
+
+	// 每一列的行按行号排列,与舞蹈链中的顺序相同
+	Columns.assign(column_count + 1, ColumnSet());
+	for (int row = 1; row <= row_count; row++)
+		for (int column : RowColumns[row])
+			Columns[column].size++;
+	for (int column = 1; column <= column_count; column++)
+	{
+		Columns[column].start = Columns[column - 1].start + Columns[column - 1].size;
+		Columns[column - 1].size = 0;
+	}
+	Columns[column_count].size = 0;
+	for (int row = 1; row <= row_count; row++)
+		for (int k = 0; k < (int)(RowColumns[row].size()); k++)
+		{
+			int node = RowStart[row] + k;
+			ColumnSet& set = Columns[RowColumns[row][k]];
+			Nodes[node].column = RowColumns[row][k];
+			Nodes[node].first = RowStart[row];
+			Nodes[node].end = RowStart[row + 1];
+			NodeRow[node] = row;
+			Nodes[node].where = set.start + set.size++;
+			Set[Nodes[node].where] = node;
+		}
+
+	Active.resize(max_column);
+	Position.assign(column_count + 1, 0);
+	Origin.assign(column_count + 1, 0);
+	for (int column = 1; column <= max_column; column++)
+	{
+		Active[column - 1] = column;
+		Position[column] = column - 1;
+	}
+	active = max_column;
+}
+
+void DancingCells::Cover(int column)
+{
+	if (column <= max_column)
+	{
+		int last = Active[--active];
+		Origin[column] = Position[column];
+		Active[Position[column]] = last;
+		Position[last] = Position[column];
+		Active[active] = column;
+		Position[column] = active;
+	}
+	int begin = Columns[column].start;
+	int end = begin + Columns[column].size;
+	for (int k = begin; k < end; k++)
+	{
+		int node = Set[k];
+		int first = Nodes[node].first;
+		int row_end = Nodes[node].end;
+		for (int j = first; j < row_end; j++)
+		{
+			if (j == node)
+				continue;
+			ColumnSet& set = Columns[Nodes[j].column];
+			int last = set.start + --set.size;
+			int moved = Set[last];
+			int where = Nodes[j].where;
+			Set[where] = moved;
+			Nodes[moved].where = where;
+			Set[last] = j;
+			Nodes[j].where = last;
+#ifdef USING_STATS
+			stats.updates++;
+#endif
+		}
+	}
+}
+
+void DancingCells::Uncover(int column)
+{
+	int begin = Columns[column].start;
+	for (int k = begin + Columns[column].size - 1; k >= begin; k--)
+	{
+		int node = Set[k];
+		int first = Nodes[node].first;
+		for (int j = Nodes[node].end - 1; j >= first; j--)
+			if (j != node)
+				Columns[Nodes[j].column].size++;
+	}
+	if (column <= max_column)
+	{
+		int origin = Origin[column];
+		int moved = Active[origin];
+		Active[active] = moved;
+		Position[moved] = active;
+		Active[origin] = column;
+		Position[column] = origin;
+		active++;
+	}
+}
+
+int DancingCells::Choose(int& least_count) const
+{
+	int now = 0;
+	least_count = INT_MAX;
+	for (int k = 0; k < active; k++)
+	{
+		// 行数相同时取编号最小的列,与舞蹈链从左到右选列的结果一致
+		int column = Active[k];
+		if (Columns[column].size < least_count || (Columns[column].size == least_count && column < now))
+		{
+			least_count = Columns[column].size;
+			now = column;
+		}
+	}
+	return now;
+}
+
+bool DancingCells::Dead() const
+{
+	uint64_t uncovered = 0;
+	for (int k = 0; k < active; k++)
+		if (Active[k] < piece_column)
+			uncovered |= pruner->getBit(Active[k]);
+	unsigned int used = 0;
+	for (int row : Answer)
+		used |= RowPiece[row];
+	return pruner->Dead(uncovered, ~used & ((1u << PIECES) - 1));
+}
+
+void DancingCells::KnownStep(int index)
+{
+	if (RowStart.empty())
+		Index();
+	Answer.push_back(index);
+	for (int j = RowStart[index]; j < RowStart[index + 1]; j++)
+		Cover(Nodes[j].column);
+}
+
+void DancingCells::UndoStep()
+{
+	int index = Answer.back();
+	Answer.pop_back();
+	for (int j = RowStart[index + 1] - 1; j >= RowStart[index]; j--)
+		Uncover(Nodes[j].column);
+}
+
+void DancingCells::Branches(vector<int>& rows)
+{
+	rows.clear();
+	if (RowStart.empty())
+		Index();
+	if (active == 0)
+		return;
+	int least_count;
+	int column = Choose(least_count);
+	for (int k = Columns[column].start; k < Columns[column].start + least_count; k++)
+		rows.push_back(NodeRow[Set[k]]);
+}
+
+void DancingCells::Spread(int level, int level_needed, vector<vector<int>>& steps_list)
+{
+	if (RowStart.empty())
+		Index();
+	Search(0, level_needed - level, &steps_list);
+}
+
+void DancingCells::Dance()
+{
+	if (RowStart.empty())
+		Index();
+	Search(0, PIECES, NULL);
+}
+
+void DancingCells::Search(int depth, int depth_needed, vector<vector<int> >* steps_list)
+{
+	// 展开时记录下的部分解是子树的根,在求解子树时计数
+	if (steps_list == NULL || depth < depth_needed)
+		CountNode((int)(Answer.size()));
+	if (active == 0)
+	{
+		Record(Answer);
+		return;
+	}
+	if (steps_list != NULL && depth == depth_needed)
+	{
+		steps_list->push_back(Answer);
+		return;
+	}
+	if (pruner != NULL && Dead())
+		return;
+
+	int least_count;
+	int column = Choose(least_count);
+	CountBranches((int)(Answer.size()), least_count);
+	Cover(column);
+	// 覆盖column后,它的行不会再被删去,这一段Set在下面的循环中保持不变
+	int begin = Columns[column].start;
+	int end = begin + least_count;
+	for (int k = begin; k < end; k++)
+	{
+		int node = Set[k];
+		int row = NodeRow[node];
+
+		// 有线程空闲时,其后的分支交给其它线程,这里只搜索当前分支
+		bool donated = k + 1 < end && ShouldDonate((int)(Answer.size()));
+		if (donated)
+			for (int sibling = k + 1; sibling < end; sibling++)
+				Donate(Answer, NodeRow[Set[sibling]]);
+
+		Answer.push_back(row);
+		for (int j = RowStart[row]; j < RowStart[row + 1]; j++)
+			if (j != node)
+				Cover(Nodes[j].column);
+		Search(depth + 1, depth_needed, steps_list);
+		for (int j = RowStart[row + 1] - 1; j >= RowStart[row]; j--)
+			if (j != node)
+				Uncover(Nodes[j].column);
+		Answer.pop_back();
+
+		if (donated)
+			break;
+	}
+	Uncover(column);
+}
+
+// 求解各个子树
+// 每个线程第一次求解时复制一个求解器,以后一直复用:选定部分解中的各行,求解后依次撤销,
+// 求解器恢复到复制时的状态,不必为每个子树复制求解器
+class SubtreeSolver
+{
+private:
+	const ISolver& solver;
+#ifdef USING_TBB
+	tbb::enumerable_thread_specific<ISolver*> solvers;
+#else
+	ISolver* local;
+#endif
+
+public:
+#ifdef USING_TBB
+	SubtreeSolver(const ISolver& solver) : solver(solver), solvers((ISolver*)NULL) {}
+	~SubtreeSolver()
+	{
+		for (ISolver* local : solvers)
+			delete local;
+	}
+#else
+	SubtreeSolver(const ISolver& solver) : solver(solver), local(NULL) {}
+	~SubtreeSolver() { delete local; }
+#endif
+
+	// 在部分解steps对应的子树上求解,解交给求解器设置的sink,返回子树中搜索过的节点数
+	long long Solve(const vector<int>& steps)
+	{
+#ifdef USING_TBB
+		ISolver*& local = solvers.local();
+#endif
+		if (local == NULL)
+		{
+			local = solver.Clone();
+#ifdef USING_STATS
+			local->SetStats(SearchStats());
+#endif
+		}
+		for (int step : steps)
+			local->KnownStep(step);
+		local->Dance();
+		for (int i = 0; i < (int)(steps.size()); i++)
+			local->UndoStep();
+		return local->TakeNodes();
+	}
+
+#ifdef USING_STATS
+	// 汇总展开、估计子树大小时和各线程求解子树时的统计数据
+	SearchStats Stats() const
+	{
+		SearchStats total = solver.getStats();
+#ifdef USING_TBB
+		for (ISolver* local : solvers)
+			if (local != NULL)
+				total += local->getStats();
+#else
+		if (local != NULL)
+			total += local->getStats();
+#endif
+		return total;
+	}
+#endif
+};
+
+// 用Knuth的随机探测法估计当前部分解对应的子树的节点数
+// 每次从子树的根开始随机选择分支直到无法继续,沿途各层分支数的累积乘积之和是节点数的无偏估计
+double EstimateSubtree(ISolver& solver, int probes, std::mt19937& random)
+{
+#ifdef USING_STATS
+	// 随机探测不属于搜索,不计入统计
+	SearchStats saved = solver.getStats();
+#endif
+	double total = 0;
+	vector<int> rows;
+	for (int probe = 0; probe < probes; probe++)
+	{
+		double weight = 1, size = 1;
+		int depth = 0;
+		for (solver.Branches(rows); !rows.empty(); solver.Branches(rows))
+		{
+			weight *= (double)(rows.size());
+			size += weight;
+			solver.KnownStep(rows[random() % rows.size()]);
+			depth++;
+		}
+		for (; depth > 0; depth--)
+			solver.UndoStep();
+		total += size;
+	}
+#ifdef USING_STATS
+	solver.SetStats(saved);
+#endif
+	return total / probes;
+}
+
+// 估计每个部分解对应的子树的大小
+vector<double> EstimateSubtrees(ISolver& solver, const vector<vector<int> >& steps_list)
+{
+	std::mt19937 random(1);
+	vector<double> estimates;
+	for (const vector<int>& steps : steps_list)
+	{
+		for (int step : steps)
+			solver.KnownStep(step);
+		estimates.push_back(EstimateSubtree(solver, PROBES, random));
+		for (int i = 0; i < (int)(steps.size()); i++)
+			solver.UndoStep();
+	}
+	return estimates;
+}
+
+// 自动分解子树
+// 从整棵树开始,每次把估计最大的子树按下一层的分支分开,直到最大的子树不超过总量的1/(BALANCE*threads),
+// 各线程的负载可以大致均衡;只有大的子树才会被继续分开,估计的开销很小
+void SplitSubtrees(ISolver& solver, int threads, vector<vector<int> >& steps_list, vector<double>& estimates)
+{
+	std::mt19937 random(1);
+	steps_list.assign(1, vector<int>());
+	estimates.assign(1, EstimateSubtree(solver, PROBES, random));
+	double total = estimates[0];
+	vector<int> rows;
+	for (;;)
+	{
+		int largest = (int)(std::max_element(estimates.begin(), estimates.end()) - estimates.begin());
+		vector<int> steps = steps_list[largest];
+		if (estimates[largest] * BALANCE * threads <= total || (int)(steps.size()) >= AUTO_LEVEL_MAX)
+			break;
+
+		for (int step : steps)
+			solver.KnownStep(step);
+		solver.Branches(rows);
+		if (rows.empty())
+		{
+			for (int i = 0; i < (int)(steps.size()); i++)
+				solver.UndoStep();
+			break;
+		}
+
+		solver.CountSplit((int)(steps.size()), (int)(rows.size()));
+		total -= estimates[largest];
+		steps_list[largest] = steps_list.back();
+		estimates[largest] = estimates.back();
+		steps_list.pop_back();
+		estimates.pop_back();
+		for (int row : rows)
+		{
+			solver.KnownStep(row);
+			double estimate = EstimateSubtree(solver, PROBES, random);
+			solver.UndoStep();
+			steps.push_back(row);
+			steps_list.push_back(steps);
+			steps.pop_back();
+			estimates.push_back(estimate);
+			total += estimate;
+		}
+
+		for (int i = 0; i < (int)(steps.size()); i++)
+			solver.UndoStep();
+	}
+}
+
+// 把子树分给shard_count个进程,只保留第shard_index个进程的子树
+// 按估计的大小从大到小,每次分给估计总量最小的进程;估计是整数的和与积,各进程得到的子树和估计都相同,分配的结果也相同
+void SelectShard(vector<vector<int> >& steps_list, vector<double>& estimates, int shard_index, int shard_count)
+{
+	vector<int> order(steps_list.size());
+	for (int i = 0; i < (int)(order.size()); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](int i, int j) { return estimates[i] > estimates[j]; });
+
+	vector<double> loads(shard_count, 0);
+	vector<int> selected;
+	for (int i : order)
+	{
+		int shard = (int)(std::min_element(loads.begin(), loads.end()) - loads.begin());
+		loads[shard] += estimates[i];
+		if (shard == shard_index)
+			selected.push_back(i);
+	}
+	std::sort(selected.begin(), selected.end());
+
+	vector<vector<int> > selected_steps;
+	vector<double> selected_estimates;
+	for (int i : selected)
+	{
+		selected_steps.push_back(steps_list[i]);
+		selected_estimates.push_back(estimates[i]);
+	}
+	steps_list.swap(selected_steps);
+	estimates.swap(selected_estimates);
+}
+
+// 把搜索到的解以排序键保存,需要展开时保存与它对称的所有解
+// 每个线程把解放在自己的缓冲区中,一个子树完成后由求解它的线程调用Seal,把缓冲区排好序作为一段;
+// 输出时对所有段多路归并,不需要对全部的解排序
+class CollectSink : public ISolutionSink
+{
+private:
+	typedef vector<SolutionKey> Run;
+
+	const SolutionKeys& keys;
+	const Symmetry* symmetry;
+	vector<Run> runs;		// 已排好序的各段
+#ifdef USING_TBB
+	tbb::combinable<Run> buffers;
+	tbb::spin_mutex mtx;
+#else
+	Run buffer;
+#endif
+
+	Run& Local()
+	{
+#ifdef USING_TBB
+		return buffers.local();
+#else
+		return buffer;
+#endif
+	}
+
+public:
+	CollectSink(const SolutionKeys& keys, const Symmetry* symmetry) : keys(keys), symmetry(symmetry) {}
+
+	void Accept(const vector<int>& solution, unsigned int /*used*/, int weight)
+	{
+		Run& local = Local();
+		if (weight == 1)
+		{
+			local.push_back(keys.Key(solution));
+			return;
+		}
+		vector<vector<int> > images;
+		symmetry->Expand(solution, images);
+		for (const vector<int>& image : images)
+			local.push_back(keys.Key(image));
+	}
+
+	// 当前线程的子树已求解完成,把缓冲区中的解排序后作为一段
+	void Seal()
+	{
+		Run& local = Local();
+		if (local.empty())
+			return;
+		Run run;
+		run.swap(local);
+		std::sort(run.begin(), run.end());
+#ifdef USING_TBB
+		tbb::spin_mutex::scoped_lock lock(mtx);
+#endif
+		runs.push_back(Run());
+		runs.back().swap(run);
+	}
+
+	// 求解结束后把各线程缓冲区中剩余的解也排序成段
+	void Finish()
+	{
+#ifdef USING_TBB
+		vector<Run> rest;
+		buffers.combine_each([&](Run& local) {
+			if (!local.empty())
+			{
+				rest.push_back(Run());
+				rest.back().swap(local);
+			}
+		});
+		tbb::parallel_for_each(rest.begin(), rest.end(), [](Run& run) { std::sort(run.begin(), run.end()); });
+		for (Run& run : rest)
+		{
+			runs.push_back(Run());
+			runs.back().swap(run);
+		}
+#else
+		Seal();
+#endif
+	}
+
+	long long size() const
+	{
+		long long total = 0;
+		for (const Run& run : runs)
+			total += (long long)(run.size());
+		return total;
+	}
+
+	// 按输出顺序依次把每个解交给output
+	template <class Output>
+	void Merge(Output output) const
+	{
+		typedef pair<int, size_t> Head;	// 段的序号和段中当前的位置
+		auto later = [&](const Head& head1, const Head& head2) {
+			return runs[head2.first][head2.second] < runs[head1.first][head1.second];
+		};
+		std::priority_queue<Head, vector<Head>, decltype(later)> heads(later);
+		for (int i = 0; i < (int)(runs.size()); i++)
+			heads.push(Head(i, 0));
+		Solution solution;
+		while (!heads.empty())
+		{
+			Head head = heads.top();
+			heads.pop();
+			keys.Rows(runs[head.first][head.second], solution);
+			output(solution);
+			if (++head.second < runs[head.first].size())
+				heads.push(head);
+		}
+	}
+};
+
+// 只统计解的数目,不保存解
+// 每个线程使用自己的计数器,搜索到解时不需要分配内存
+class CountSink : public ISolutionSink
+{
+public:
+	struct Counter
+	{
+		long long total;
+		vector<long long> subsets;	// 按用到的积木分别统计的解的数目
+		Counter() : total(0) {}
+	};
+
+private:
+	bool by_subset;
+#ifdef USING_TBB
+	tbb::combinable<Counter> counters;
+#else
+	Counter counter;
+#endif
+
+public:
+	CountSink(bool by_subset) : by_subset(by_subset) {}
+
+	// 当前线程的计数器
+	Counter& Local()
+	{
+#ifdef USING_TBB
+		return counters.local();
+#else
+		return counter;
+#endif
+	}
+
+	void Accept(const vector<int>& /*solution*/, unsigned int used, int weight)
+	{
+		Counter& local = Local();
+		local.total += weight;
+		if (by_subset)
+		{
+			if (local.subsets.empty())
+				local.subsets.resize(1 << PIECES, 0);
+			local.subsets[used] += weight;
+		}
+	}
+
+	// 汇总所有线程的计数
+	Counter Total()
+	{
+		Counter total;
+		if (by_subset)
+			total.subsets.resize(1 << PIECES, 0);
+		auto add = [&](const Counter& local) {
+			total.total += local.total;
+			for (int i = 0; i < (int)(local.subsets.size()); i++)
+				total.subsets[i] += local.subsets[i];
+		};
+#ifdef USING_TBB
+		counters.combine_each(add);
+#else
+		add(counter);
+#endif
+		return total;
+	}
+};
+
+// 显示求解进度
+// 尚未完成的子树的估计大小减去其中已搜索的节点数作为剩余的节点数,由此得到完成的比例和剩余时间;
+// 多线程时由单独的线程定时显示,求解的线程只累加计数
+// 没有估计时(如折半搜索一次求出所有的解)只显示搜索过的节点数和速度
+class Progress : public IProgress
+{
+private:
+	chrono::steady_clock::time_point start;
+	double shown;		// 已显示的完成比例,显示的比例不后退
+	bool estimated;		// 是否有子树大小的估计
+#ifdef USING_TBB
+	tbb::atomic<long long> nodes;		// 已搜索的节点数
+	tbb::atomic<long long> running;	// 未完成的子树中已搜索的节点数
+	tbb::atomic<long long> pending;	// 未完成的子树估计的节点数
+	tbb::atomic<bool> stop;
+	std::thread reporter;
+#else
+	long long nodes;
+	long long running;
+	long long pending;
+	chrono::steady_clock::time_point last;
+#endif
+
+	double Elapsed() const
+	{
+		return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
+	// 用K、M、G表示较大的数
+	static string FormatCount(double value)
+	{
+		const char* units[] = { "", "K", "M", "G", "T" };
+		int unit = 0;
+		while (value >= 1000 && unit < 4)
+		{
+			value /= 1000;
+			unit++;
+		}
+		char buffer[32];
+		snprintf(buffer, sizeof(buffer), unit == 0 ? "%.0f%s" : "%.1f%s", value, units[unit]);
+		return buffer;
+	}
+
+	// 显示为时:分:秒
+	static string FormatTime(double seconds)
+	{
+		long long value = (long long)(seconds + 0.5);
+		char buffer[32];
+		snprintf(buffer, sizeof(buffer), "%lld:%02lld:%02lld", value / 3600, value / 60 % 60, value % 60);
+		return buffer;
+	}
+
+	void Report()
+	{
+		double elapsed = Elapsed();
+		double searched = (double)(nodes);
+		if (!estimated)
+		{
+			std::cout << "\r" << FormatCount(searched) << " nodes, " << FormatCount(elapsed > 0 ? searched / elapsed : 0) << " nodes/s    " << flush;
+			return;
+		}
+		double remaining = (std::max)((double)(pending) - (double)(running), 0.0);
+		double ratio = searched + remaining > 0 ? (std::min)(searched / (searched + remaining), 0.999) : 0;
+		shown = (std::max)(shown, ratio);
+		double rate = elapsed > 0 ? searched / elapsed : 0;
+		std::cout << "\r" << (int)(shown * 1000) / 10 << "." << (int)(shown * 1000) % 10 << "% completed, "
+			<< FormatCount(rate) << " nodes/s, ETA " << (rate > 0 ? FormatTime(remaining / rate) : string("-")) << "    " << flush;
+	}
+
+public:
+	// total为所有子树估计的节点数,为0时表示没有估计
+	Progress(double total) : start(chrono::steady_clock::now()), shown(0), estimated(total > 0), nodes(0), running(0), pending((long long)(total + 0.5))
+	{
+#ifdef USING_TBB
+		stop = false;
+		reporter = std::thread([this]() {
+			while (!stop)
+			{
+				for (int i = 0; i < PROGRESS_INTERVAL / 50 && !stop; i++)
+					std::this_thread::sleep_for(chrono::milliseconds(50));
+				if (!stop)
+					Report();
+			}
+		});
+#else
+		last = start;
+#endif
+	}
+
+	void AddNodes(long long count)
+	{
+		nodes += count;
+		running += count;
+#ifndef USING_TBB
+		// 单线程时在搜索过程中定时显示
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		if (now - last >= chrono::milliseconds(PROGRESS_INTERVAL))
+		{
+			last = now;
+			Report();
+		}
+#endif
+	}
+
+	// 估计有estimate个节点的子树已完成,实际搜索了count个节点
+	void Finish(double estimate, long long count)
+	{
+		pending -= (long long)(estimate + 0.5);
+		running -= count;
+	}
+
+	// 结束显示,给出搜索过的总节点数
+	void Stop()
+	{
+#ifdef USING_TBB
+		stop = true;
+		reporter.join();
+#endif
+		double elapsed = Elapsed();
+		std::cout << "\r100% completed, " << FormatCount((double)(nodes)) << " nodes, "
+			<< FormatCount(elapsed > 0 ? (double)(nodes) / elapsed : 0) << " nodes/s.        " << endl;
+	}
+};
+
+#ifdef USING_TBB
+// 动态分解子树的任务池
+// 从整棵解空间树开始求解,正在求解的线程发现有线程空闲时,把尚未搜索的兄弟分支分出来,
+// 由空闲的线程窃取执行,不需要事先选择广度优先分解的层数
+class TaskPool : public ITaskPool
+{
+private:
+	SubtreeSolver& subtrees;
+	tbb::task_group group;
+	tbb::atomic<int> pending;		// 已分出但尚未开始执行的子树数目
+	int threads;
+
+public:
+	TaskPool(SubtreeSolver& subtrees) : subtrees(subtrees), pending(0)
+	{
+		threads = tbb::this_task_arena::max_concurrency();
+	}
+
+	bool Hungry() const { return pending < threads; }
+
+	void Donate(const vector<int>& steps)
+	{
+		pending++;
+		group.run([this, steps]() {
+			pending--;
+			subtrees.Solve(steps);
+		});
+	}
+
+	// 求解整棵解空间树,等待所有分出的子树完成
+	void Run()
+	{
+		Donate(vector<int>());
+		group.wait();
+	}
+};
+#endif
+
+// 以文本输出解,按图案的版面查表,由各行占据的位置直接写出每个字符
+// 文本先写入可重复使用的缓冲区,攒够RENDER_BUFFER字节后一次写出;
+// 输出到控制台时不同积木用不同颜色表示,相邻的同色字符只设置一次颜色;columns个解左右并排输出
+class SolutionRenderer
+{
+private:
+	vector<vector<int> > layout;
+	size_t width;			// 版面最宽一行的字符数
+	vector<Step> steps;
+	std::ostream& out;
+	bool color;
+	int columns;
+	vector<int> blocks;		// 等待输出的各个解中每个位置上的积木序号,每个解size+1项
+	int pending;
+	string buffer;
+#if defined(_WIN32) || defined(_WIN64)
+	HANDLE handle;
+	WORD old_attributes;
+#endif
+
+	void Flush()
+	{
+		out.write(buffer.data(), buffer.size());
+		buffer.clear();
+	}
+
+	// block_index为-1时恢复原来的颜色
+	void SetColor(int block_index)
+	{
+#if defined(_WIN32) || defined(_WIN64)
+		Flush();
+		out.flush();
+		SetConsoleTextAttribute(handle, block_index < 0 ? old_attributes : console_color[block_index]);
+#else
+		buffer += ansi_color[block_index < 0 ? PIECES : block_index];
+#endif
+	}
+
+	// 把等待输出的解并排写入缓冲区
+	void Render()
+	{
+		int cell_count = (int)(blocks.size()) / columns;
+		for (const vector<int>& line : layout)
+		{
+			for (int k = 0; k < pending; k++)
+			{
+				const int* cells = blocks.data() + k * cell_count;
+				int current = -1;
+				for (int index : line)
+				{
+					int block_index = index == 0 ? -1 : cells[index];
+					if (block_index == -1)
+					{
+						buffer += ' ';
+						continue;
+					}
+					if (color && block_index != current)
+						SetColor(block_index);
+					current = block_index;
+					buffer += piece_map[block_index][0];
+				}
+				if (color && current != -1)
+					SetColor(-1);
+				if (k + 1 < pending)
+					buffer.append(width - line.size() + 2, ' ');
+			}
+			buffer += '\n';
+		}
+		buffer += '\n';
+		pending = 0;
+		if ((int)(buffer.size()) >= RENDER_BUFFER)
+			Flush();
+	}
+
+	// 下一个解中每个位置上的积木序号,未覆盖的位置显示为第一块积木
+	int* Next()
+	{
+		int cell_count = (int)(blocks.size()) / columns;
+		int* cells = blocks.data() + pending * cell_count;
+		std::fill(cells, cells + cell_count, 0);
+		return cells;
+	}
+
+	void Add()
+	{
+		if (++pending == columns)
+			Render();
+	}
+
+public:
+	template <class Steps>
+	SolutionRenderer(const IPattern& pattern, const Steps& steps, std::ostream& out, bool color, int columns)
+		: layout(pattern.GetLayout()), width(0), steps(steps.begin(), steps.end()), out(out), color(color),
+		columns((std::max)(columns, 1)), pending(0)
+	{
+		for (const vector<int>& line : layout)
+			width = (std::max)(width, line.size());
+		blocks.resize((size_t)(this->columns) * (pattern.size() + 1), 0);
+		buffer.reserve(RENDER_BUFFER * 2);
+#if defined(_WIN32) || defined(_WIN64)
+		handle = GetStdHandle(STD_OUTPUT_HANDLE);
+		CONSOLE_SCREEN_BUFFER_INFO csbiInfo;
+		GetConsoleScreenBufferInfo(handle, &csbiInfo);
+		old_attributes = csbiInfo.wAttributes;
+#endif
+	}
+
+	~SolutionRenderer() { Finish(); }
+
+	// 由行号表示的解
+	void Write(const Solution& solution)
+	{
+		int* cells = Next();
+		for (int row : solution)
+			for (int index : steps[row - 1].indecies)
+				cells[index] = steps[row - 1].block_index;
+		Add();
+	}
+
+	// 由Step表示的解
+	void Write(const vector<Step>& solution)
+	{
+		int* cells = Next();
+		for (const Step& step : solution)
+			for (int index : step.indecies)
+				cells[index] = step.block_index;
+		Add();
+	}
+
+	// 写出还未并排满的解和缓冲区中的所有文本
+	void Finish()
+	{
+		if (pending > 0)
+			Render();
+		Flush();
+		out.flush();
+	}
+};
+
+// 二进制格式的解文件,整数都按本机字节序存放
+// 文件头:"IQPS",版本,图案类型,设置的长度(32位整数)和内容,关系矩阵的行数,
+//         每一行的积木序号,形状序号,x,y,位置数目和各个位置(都是16位整数),解的数目(64位整数)
+// 设置与分片的计数文件相同,每行一项,包括图案、对称性、引擎、层数和"shard i/N",--merge时据此检查分片
+// 之后每个解PIECES个16位整数,依次为每块积木所在的行号,未用到的积木为0xFFFF
+static const char BINARY_MAGIC[4] = { 'I', 'Q', 'P', 'S' };
+static const uint32_t BINARY_VERSION = 2;
+static const uint16_t BINARY_UNUSED = 0xFFFF;
+
+// 压缩格式的解文件,利用排好序的解前面的积木常常相同
+// 文件头以"IQPA"开头,其余与二进制格式相同,解的数目之后是每段的解数(32位)和段索引的位置(64位)
+// 解按顺序分段,每段从字节边界开始;每个解与前一个解(段中第一个解与全空的解)比较,先用4位记下前面相同的积木数目n,
+// 再依次记下积木n--11所在的行是这种积木可以放的行中的第几个(未用到为0),位数由可以放的行数决定
+// 文件末尾是段索引,为每段开始的位置(64位整数),读取第k个解时只需解码它所在的段
+static const char ARCHIVE_MAGIC[4] = { 'I', 'Q', 'P', 'A' };
+static const int ARCHIVE_SHARED_BITS = 4;
+
+// 压缩格式中积木所在的行与编码的转换
+// 图案不超过64个位置时,只在与已放下的积木不重叠的行中编号,越往后可以放的行越少,编码越短
+class ArchiveCodec
+{
+private:
+	int first_row[PIECES];		// 这种积木的第一行之前的行号
+	int row_count[PIECES];		// 这种积木的行数
+	vector<uint64_t> masks;		// 每一行占据的位置,图案超过64个位置时为空
+
+public:
+	template <class Steps>
+	ArchiveCodec(const Steps& steps) : masks(steps.size() + 1, 0)
+	{
+		std::fill(first_row, first_row + PIECES, 0);
+		std::fill(row_count, row_count + PIECES, 0);
+		for (int i = 0; i < (int)(steps.size()); i++)
+		{
+			if (row_count[steps[i].block_index]++ == 0)
+				first_row[steps[i].block_index] = i;
+			for (int index : steps[i].indecies)
+			{
+				if (index > 64)
+				{
+					masks.clear();
+					return;
+				}
+				masks[i + 1] |= 1ull << (index - 1);
+			}
+		}
+	}
+
+	// 行占据的位置,未用到的积木为0
+	uint64_t Mask(uint16_t row) const { return row == BINARY_UNUSED || masks.empty() ? 0 : masks[row]; }
+
+	// 已覆盖covered时积木block_index可以放的行按顺序放在rows中,返回行数
+	int Candidates(int block_index, uint64_t covered, uint16_t* rows) const
+	{
+		int first = first_row[block_index] + 1, count = 0;
+		if (masks.empty())
+		{
+			for (int i = 0; i < row_count[block_index]; i++)
+				rows[i] = (uint16_t)(first + i);
+			return row_count[block_index];
+		}
+		const uint64_t* mask = masks.data() + first;
+		for (int i = 0; i < row_count[block_index]; i++)
+		{
+			rows[count] = (uint16_t)(first + i);
+			count += (mask[i] & covered) == 0;
+		}
+		return count;
+	}
+
+	// 编码row的位数为Width(count),可以放的行中的第几个,未用到为0
+	static int Width(int count)
+	{
+		int width = 0;
+		while ((count >> width) != 0)
+			width++;
+		return width;
+	}
+};
+
+template <class T>
+void WriteValue(std::ostream& out, T value)
+{
+	out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// 输出二进制格式的解
+// archive为true时输出压缩格式
+class BinaryWriter
+{
+private:
+	std::ostream& out;
+	std::streampos count_pos;
+	long long count;
+	vector<int> RowBlock;			// 每一行用到的积木
+	map<vector<int>, int> Rows;	// 积木序号和占据的位置对应的行号
+
+	bool archive;
+	ArchiveCodec codec;
+	vector<uint16_t> candidates;
+	uint16_t previous[PIECES];	// 前一个解中每块积木所在的行
+	string bytes;				// 当前段已编码的字节
+	uint64_t bits;				// 还不满一个字节的位
+	int bit_count;
+	vector<uint64_t> blocks;	// 每段开始的位置
+
+	void PutBits(int value, int width)
+	{
+		bits |= (uint64_t)(value) << bit_count;
+		bit_count += width;
+		for (; bit_count >= 8; bit_count -= 8, bits >>= 8)
+			bytes += (char)(bits & 0xFF);
+	}
+
+	// 写出当前段,不满一个字节的位补0
+	void FlushBlock()
+	{
+		if (bit_count > 0)
+			PutBits(0, 8 - bit_count);
+		out.write(bytes.data(), bytes.size());
+		bytes.clear();
+	}
+
+	void WriteSlots(const uint16_t* slots)
+	{
+		if (!archive)
+		{
+			out.write(reinterpret_cast<const char*>(slots), PIECES * sizeof(uint16_t));
+			count++;
+			return;
+		}
+		if (count % ARCHIVE_BLOCK == 0)
+		{
+			FlushBlock();
+			blocks.push_back((uint64_t)(out.tellp()));
+			std::fill(previous, previous + PIECES, BINARY_UNUSED);
+		}
+		int shared = 0;
+		while (shared < PIECES && slots[shared] == previous[shared])
+			shared++;
+		PutBits(shared, ARCHIVE_SHARED_BITS);
+		uint64_t covered = 0;
+		for (int block_index = 0; block_index < PIECES; block_index++)
+		{
+			if (block_index >= shared)
+			{
+				int count = codec.Candidates(block_index, covered, candidates.data());
+				int value = slots[block_index] == BINARY_UNUSED ? 0
+					: (int)(std::lower_bound(candidates.data(), candidates.data() + count, slots[block_index]) - candidates.data()) + 1;
+				PutBits(value, ArchiveCodec::Width(count));
+			}
+			covered |= codec.Mask(slots[block_index]);
+		}
+		std::copy(slots, slots + PIECES, previous);
+		count++;
+	}
+
+public:
+	template <class Steps>
+	BinaryWriter(std::ostream& out, const string& type, const string& settings, const Steps& steps, bool archive = false)
+		: out(out), count(0), archive(archive), codec(steps), candidates(steps.size()), bits(0), bit_count(0)
+	{
+		char type_name[8] = { 0 };
+		type.copy(type_name, sizeof(type_name) - 1);
+		out.write(archive ? ARCHIVE_MAGIC : BINARY_MAGIC, sizeof(BINARY_MAGIC));
+		WriteValue<uint32_t>(out, BINARY_VERSION);
+		out.write(type_name, sizeof(type_name));
+		WriteValue<uint32_t>(out, (uint32_t)(settings.size()));
+		out.write(settings.data(), settings.size());
+		WriteValue<uint32_t>(out, (uint32_t)(steps.size()));
+		RowBlock.resize(steps.size() + 1, 0);
+		for (int i = 0; i < (int)(steps.size()); i++)
+		{
+			const Step& step = steps[i];
+			WriteValue<uint16_t>(out, (uint16_t)(step.block_index));
+			WriteValue<uint16_t>(out, (uint16_t)(step.shape_index));
+			WriteValue<uint16_t>(out, (uint16_t)(step.x));
+			WriteValue<uint16_t>(out, (uint16_t)(step.y));
+			WriteValue<uint16_t>(out, (uint16_t)(step.indecies.size()));
+			for (int index : step.indecies)
+				WriteValue<uint16_t>(out, (uint16_t)(index));
+
+			vector<int> key(1, step.block_index);
+			key.insert(key.end(), step.indecies.begin(), step.indecies.end());
+			Rows[key] = i + 1;
+			RowBlock[i + 1] = step.block_index;
+		}
+		count_pos = out.tellp();
+		WriteValue<uint64_t>(out, 0);
+		if (archive)
+		{
+			WriteValue<uint32_t>(out, (uint32_t)(ARCHIVE_BLOCK));
+			WriteValue<uint64_t>(out, 0);
+		}
+	}
+
+	// 输出由行号表示的解
+	template <class Rows>
+	void Write(const Rows& result)
+	{
+		uint16_t slots[PIECES];
+		std::fill(slots, slots + PIECES, BINARY_UNUSED);
+		for (int row : result)
+			slots[RowBlock[row]] = (uint16_t)(row);
+		WriteSlots(slots);
+	}
+
+	// 输出由Step表示的解
+	void Write(const vector<Step>& solution)
+	{
+		uint16_t slots[PIECES];
+		std::fill(slots, slots + PIECES, BINARY_UNUSED);
+		for (const Step& step : solution)
+		{
+			vector<int> key(1, step.block_index);
+			key.insert(key.end(), step.indecies.begin(), step.indecies.end());
+			slots[step.block_index] = (uint16_t)(Rows[key]);
+		}
+		WriteSlots(slots);
+	}
+
+	// 在文件头中填入解的数目,压缩格式还要写出段索引
+	long long Finish()
+	{
+		uint64_t index_pos = 0;
+		if (archive)
+		{
+			FlushBlock();
+			index_pos = (uint64_t)(out.tellp());
+			for (uint64_t block : blocks)
+				WriteValue<uint64_t>(out, block);
+		}
+		std::streampos end = out.tellp();
+		out.seekp(count_pos);
+		WriteValue<uint64_t>(out, (uint64_t)(count));
+		if (archive)
+		{
+			WriteValue<uint32_t>(out, (uint32_t)(ARCHIVE_BLOCK));
+			WriteValue<uint64_t>(out, index_pos);
+		}
+		out.seekp(end);
+		out.flush();
+		return count;
+	}
+};
+
+// 边搜索边把解输出到文件,不排序
+// 每个线程先把解放在自己的缓冲区中,攒够一批后交给后台的写文件线程;
+// 等待写文件的批次达到上限时搜索线程等待,占用的内存不随解的数目增长
+// binary不为NULL时输出二进制格式
+template <class Steps>
+class StreamSink : public ISolutionSink
+{
+private:
+	typedef vector<Solution> Batch;
+
+	const IPattern& pattern;
+	const Steps& steps;
+	const Symmetry* symmetry;
+	std::ofstream& fout;
+	BinaryWriter* binary;
+	long long written;
+	SolutionRenderer renderer;	// 只在写文件的线程中使用
+#ifdef USING_TBB
+	tbb::combinable<Batch> buffers;
+	tbb::concurrent_bounded_queue<Batch*> queue;	// NULL表示搜索已结束
+	std::thread writer;
+#endif
+
+	void Write(const Solution& result)
+	{
+		if (binary != NULL)
+		{
+			binary->Write(result);
+			written++;
+			return;
+		}
+		renderer.Write(result);
+		written++;
+	}
+
+#ifdef USING_TBB
+	void Write()
+	{
+		Batch* batch;
+		for (queue.pop(batch); batch != NULL; queue.pop(batch))
+		{
+			for (const Solution& result : *batch)
+				Write(result);
+			fout.flush();
+			delete batch;
+		}
+	}
+#endif
+
+public:
+	StreamSink(const IPattern& pattern, const Steps& steps, const Symmetry* symmetry, std::ofstream& fout, BinaryWriter* binary)
+		: pattern(pattern), steps(steps), symmetry(symmetry), fout(fout), binary(binary), written(0), renderer(pattern, steps, fout, false, 1)
+	{
+#ifdef USING_TBB
+		queue.set_capacity(STREAM_QUEUE);
+		writer = std::thread([this]() { Write(); });
+#endif
+	}
+
+	void Accept(const vector<int>& solution, unsigned int /*used*/, int weight)
+	{
+#ifdef USING_TBB
+		Batch& buffer = buffers.local();
+		if (weight == 1)
+			buffer.push_back(Solution(solution));
+		else
+		{
+			vector<vector<int> > images;
+			symmetry->Expand(solution, images);
+			for (const vector<int>& image : images)
+				buffer.push_back(Solution(image));
+		}
+		if ((int)(buffer.size()) >= STREAM_BATCH)
+		{
+			// 交出当前的缓冲区,队列已满时等待
+			Batch* batch = new Batch();
+			batch->swap(buffer);
+			queue.push(batch);
+		}
+#else
+		if (weight == 1)
+		{
+			Write(Solution(solution));
+			return;
+		}
+		vector<vector<int> > images;
+		symmetry->Expand(solution, images);
+		for (const vector<int>& image : images)
+			Write(Solution(image));
+#endif
+	}
+
+	// 搜索结束后写出各线程缓冲区中剩余的解,等待写文件线程结束,返回写出的解的数目
+	long long Finish()
+	{
+#ifdef USING_TBB
+		buffers.combine_each([&](const Batch& buffer) {
+			if (!buffer.empty())
+				queue.push(new Batch(buffer));
+		});
+		queue.push(NULL);
+		writer.join();
+#endif
+		if (binary != NULL)
+			return binary->Finish();
+		renderer.Finish();
+		fout << written << " solution(s) found." << endl;
+		return written;
+	}
+};
+
+// 检查点文件,记录分解出的子树和已完成的子树中的解,中断后可以从已完成的子树之后继续
+// 作为求解器的sink,每个线程先把当前子树的解放在自己的缓冲区中,子树完成后一起写入文件并交给真正的sink;
+// 只计数时只记录按用到的积木分别统计的解的数目
+// 文件格式为文本,先是表示图案和设置的头部和各个子树的部分解,之后每完成一个子树追加
+// "subtree 序号 记录数",每条记录一行:用到的积木 解的数目 各行,最后以"end 序号"结束
+class Checkpoint : public ISolutionSink
+{
+private:
+	struct Record
+	{
+		unsigned int used;
+		long long weight;
+		vector<int> solution;
+	};
+	typedef vector<Record> Records;
+
+	string filename;
+	ISolutionSink& target;
+	bool count_only;
+	std::ofstream fout;
+	map<int, Records> done;		// 已完成的子树中的解
+#ifdef USING_TBB
+	tbb::combinable<Records> buffers;
+	tbb::spin_mutex mtx;
+#else
+	Records buffer;
+#endif
+
+	Records& Local()
+	{
+#ifdef USING_TBB
+		return buffers.local();
+#else
+		return buffer;
+#endif
+	}
+
+	void Write(int index, const Records& records)
+	{
+		fout << "subtree " << index << " " << records.size() << "\n";
+		for (const Record& record : records)
+		{
+			fout << record.used << " " << record.weight;
+			for (int row : record.solution)
+				fout << " " << row;
+			fout << "\n";
+		}
+		fout << "end " << index << endl;
+	}
+
+	// 把解交给真正的sink,返回解的数目
+	long long Forward(const Records& records)
+	{
+		long long total = 0;
+		for (const Record& record : records)
+		{
+			for (long long weight = record.weight; weight > 0; weight -= INT_MAX)
+				target.Accept(record.solution, record.used, (int)((std::min)(weight, (long long)(INT_MAX))));
+			total += record.weight;
+		}
+		return total;
+	}
+
+public:
+	Checkpoint(const string& filename, ISolutionSink& target, bool count_only) : filename(filename), target(target), count_only(count_only) {}
+
+	// 读取检查点文件,header为图案和设置,steps_list为其中记录的子树
+	// 文件不存在时steps_list为空;header不同时返回false
+	// 最后一个子树的记录不完整时(写入时被中断)忽略这个子树
+	bool Load(const string& header, vector<vector<int> >& steps_list)
+	{
+		steps_list.clear();
+		std::ifstream fin(filename, ios::in);
+		if (!fin)
+			return true;
+		std::stringstream text;
+		text << fin.rdbuf();
+		string content = text.str();
+		if (content.compare(0, header.size(), header) != 0)
+			return false;
+		std::istringstream in(content.substr(header.size()));
+
+		string word, line;
+		int count = 0;
+		if (!(in >> word >> count) || word != "subtrees")
+			return false;
+		std::getline(in, line);
+		for (int i = 0; i < count; i++)
+		{
+			if (!std::getline(in, line))
+				return false;
+			std::istringstream rows(line);
+			vector<int> steps;
+			for (int row; rows >> row;)
+				steps.push_back(row);
+			steps_list.push_back(steps);
+		}
+
+		int index;
+		long long size;
+		while (in >> word >> index >> size && word == "subtree")
+		{
+			std::getline(in, line);
+			Records records;
+			for (long long i = 0; i < size && std::getline(in, line); i++)
+			{
+				std::istringstream values(line);
+				Record record;
+				values >> record.used >> record.weight;
+				for (int row; values >> row;)
+					record.solution.push_back(row);
+				records.push_back(record);
+			}
+			int end;
+			if (!(in >> word >> end) || word != "end" || end != index || index < 0 || index >= count)
+				break;
+			done[index].swap(records);
+		}
+		return true;
+	}
+
+	// 已完成的子树的数目
+	int Completed() const { return (int)(done.size()); }
+
+	// 重写检查点文件:header、子树和已完成的子树,之后每完成一个子树追加一次
+	// 先写入临时文件再改名,改写时被中断也不会丢失原有的检查点
+	void Start(const string& header, const vector<vector<int> >& steps_list)
+	{
+		string temp = filename + ".tmp";
+		fout.open(temp, ios::out | ios::trunc);
+		fout << header << "subtrees " << steps_list.size() << "\n";
+		for (const vector<int>& steps : steps_list)
+		{
+			for (int i = 0; i < (int)(steps.size()); i++)
+				fout << (i == 0 ? "" : " ") << steps[i];
+			fout << "\n";
+		}
+		for (const pair<const int, Records>& subtree : done)
+			Write(subtree.first, subtree.second);
+		fout.close();
+		std::remove(filename.c_str());
+		std::rename(temp.c_str(), filename.c_str());
+		fout.open(filename, ios::out | ios::app);
+	}
+
+	void Accept(const vector<int>& solution, unsigned int used, int weight)
+	{
+		Records& records = Local();
+		if (count_only)
+		{
+			for (Record& record : records)
+				if (record.used == used)
+				{
+					record.weight += weight;
+					return;
+				}
+			records.push_back(Record{ used, weight, vector<int>() });
+		}
+		else
+			records.push_back(Record{ used, weight, solution });
+	}
+
+	// 第index个子树已在当前线程中求解完成,或在检查点中已完成,把它的解交给真正的sink,返回解的数目
+	long long Commit(int index)
+	{
+		map<int, Records>::const_iterator found = done.find(index);
+		if (found != done.end())
+			return Forward(found->second);
+
+		Records records;
+		records.swap(Local());
+		{
+#ifdef USING_TBB
+			tbb::spin_mutex::scoped_lock lock(mtx);
+#endif
+			Write(index, records);
+		}
+		return Forward(records);
+	}
+
+	// 第index个子树在检查点中是否已完成
+	bool Done(int index) const { return done.count(index) != 0; }
+};
+
+// 输出只计数时的统计结果
+// prefix_counts为每个部分解对应的子树中解的数目,subsets为按用到的积木分别统计的解的数目
+template <class Steps>
+void OutputCounts(std::ostream& out, const CountSink::Counter& total, const Steps& steps, const vector<vector<int> >& steps_list, const vector<long long>& prefix_counts)
+{
+	if (total.total == 0)
+		out << "No solution found." << endl;
+	else
+		out << total.total << " solution(s) found." << endl;
+
+	if (!prefix_counts.empty())
+	{
+		out << endl << "Solutions by partial solution:" << endl;
+		for (int i = 0; i < (int)(steps_list.size()); i++)
+		{
+			for (int index : steps_list[i])
+			{
+				const Step& step = steps[index - 1];
+				out << piece_map[step.block_index] << "(" << step.shape_index << "," << step.x << "," << step.y << ") ";
+			}
+			out << ": " << prefix_counts[i] << endl;
+		}
+	}
+
+	if (!total.subsets.empty())
+	{
+		out << endl << "Solutions by pieces used:" << endl;
+		for (unsigned int used = 0; used < total.subsets.size(); used++)
+		{
+			if (total.subsets[used] == 0)
+				continue;
+			for (int block_index = 0; block_index < PIECES; block_index++)
+				if ((used & (1u << block_index)) != 0)
+					out << piece_map[block_index];
+			out << ": " << total.subsets[used] << endl;
+		}
+	}
+}
+
+// 记录求解各阶段的耗时
+class PhaseTimer
+{
+private:
+	vector<pair<string, double> > phases;
+	chrono::steady_clock::time_point last;
+
+public:
+	PhaseTimer() : last(chrono::steady_clock::now()) {}
+
+	// 结束名为name的阶段,开始下一阶段
+	void Mark(const string& name)
+	{
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		phases.push_back(make_pair(name, chrono::duration<double>(now - last).count()));
+		last = now;
+	}
+
+	const vector<pair<string, double> >& getPhases() const { return phases; }
+};
+
+// 以JSON格式输出各阶段的耗时,以及打开USING_STATS编译时搜索树每一层的统计数据
+void OutputStats(std::ostream& out, const string& type, const string& engine, const string& split, int level, const PhaseTimer& timer, const SubtreeSolver& subtrees)
+{
+	out << "{" << endl;
+	out << "  \"type\": \"" << type << "\"," << endl;
+	out << "  \"engine\": \"" << engine << "\"," << endl;
+	out << "  \"split\": \"" << split << "\"," << endl;
+	out << "  \"level\": " << level << "," << endl;
+	out << "  \"phases\": {" << endl;
+	double total = 0;
+	for (const pair<string, double>& phase : timer.getPhases())
+	{
+		out << "    \"" << phase.first << "\": " << phase.second << "," << endl;
+		total += phase.second;
+	}
+	out << "    \"total\": " << total << endl;
+	out << "  }," << endl;
+#ifdef USING_STATS
+	SearchStats stats = subtrees.Stats();
+	long long nodes = 0;
+	out << "  \"search\": {" << endl;
+	out << "    \"levels\": [" << endl;
+	for (int depth = 0; depth <= PIECES; depth++)
+	{
+		nodes += stats.nodes[depth];
+		out << "      { \"depth\": " << depth << ", \"nodes\": " << stats.nodes[depth] << ", \"choices\": " << stats.choices[depth]
+			<< ", \"branching\": " << (stats.choices[depth] > 0 ? (double)(stats.branches[depth]) / stats.choices[depth] : 0) << " }"
+			<< (depth < PIECES ? "," : "") << endl;
+	}
+	out << "    ]," << endl;
+	out << "    \"nodes\": " << nodes << "," << endl;
+	out << "    \"updates\": " << stats.updates << endl;
+	out << "  }" << endl;
+#else
+	(void)subtrees;
+	out << "  \"search\": null" << endl;
+#endif
+	out << "}" << endl;
+}
+
+// 显示对称性的处理方式
+void PrintSymmetry(const Symmetry& symmetry)
+{
+	std::cout << "Symmetries: " << symmetry.size();
+	if (symmetry.getRestricted() != -1)
+		std::cout << ", Restricted Piece: " << piece_map[symmetry.getRestricted()];
+	std::cout << endl;
+}
+
+// 依据图案类型创建图案,类型未知时返回NULL
+IPattern* CreatePattern(const string& type)
+{
+	if (type == "t")
+		return new TrianglePattern();
+	else if (type == "r")
+		return new RectanglePattern();
+	else if (type == "p4")
+		return new PyramidPattern(4);
+	else if (type == "p5")
+		return new PyramidPattern(5);
+	return NULL;
+}
+
+// 以只读方式映射到内存的文件
+class MappedFile
+{
+private:
+	const char* data;
+	size_t length;
+#if defined(_WIN32) || defined(_WIN64)
+	HANDLE file;
+	HANDLE mapping;
+#endif
+
+public:
+	MappedFile(const string& filename) : data(NULL), length(0)
+	{
+#if defined(_WIN32) || defined(_WIN64)
+		mapping = NULL;
+		file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+			return;
+		mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL)
+			return;
+		data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (data != NULL)
+			length = (size_t)(size.QuadPart);
+#else
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd == -1)
+			return;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			void* view = mmap(NULL, (size_t)(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+			if (view != MAP_FAILED)
+			{
+				data = (const char*)view;
+				length = (size_t)(st.st_size);
+			}
+		}
+		close(fd);
+#endif
+	}
+
+	~MappedFile()
+	{
+#if defined(_WIN32) || defined(_WIN64)
+		if (data != NULL)
+			UnmapViewOfFile(data);
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if (data != NULL)
+			munmap((void*)data, length);
+#endif
+	}
+
+	const char* getData() const { return data; }
+	size_t size() const { return length; }
+};
+
+// 读取二进制格式或压缩格式的解文件
+// 关系矩阵的各行从文件头中读出,二进制格式的解直接在映射的内存中访问;
+// 压缩格式的解按需解码,顺序读取时依次解码下一个解,否则从所在段的开头解码;
+// 打开时只检查段索引,每段的数据在解码到时才检查
+class SolutionFile
+{
+private:
+	MappedFile file;
+	string type;
+	string settings;
+	vector<Step> steps;
+	long long count;
+	const uint16_t* solutions;
+
+	bool archive;
+	ArchiveCodec* codec;
+	uint32_t block_size;
+	vector<uint64_t> blocks;			// 每段开始的位置
+	uint64_t index_pos;					// 段索引的位置,也是最后一段结束的位置
+	mutable uint16_t current[PIECES];	// 最近解码的解
+	mutable long long current_index;
+	mutable uint64_t bit_pos;			// 下一个解在文件中的位置,以位计
+	mutable uint64_t bit_end;			// 当前段结束的位置,以位计
+	mutable vector<uint16_t> candidates;
+
+	bool GetBits(int width, int& value) const
+	{
+		value = 0;
+		for (int done = 0; done < width;)
+		{
+			if (bit_pos >= bit_end)
+				return false;
+			uint64_t byte = bit_pos >> 3;
+			int shift = (int)(bit_pos & 7);
+			int take = (std::min)(8 - shift, width - done);
+			value |= ((((unsigned char)(file.getData()[byte])) >> shift) & ((1 << take) - 1)) << done;
+			done += take;
+			bit_pos += take;
+		}
+		return true;
+	}
+
+	// 解码下一个解,放在current中,数据不对时返回false
+	bool DecodeNext() const
+	{
+		current_index++;
+		if (current_index % block_size == 0)
+		{
+			size_t block = (size_t)(current_index / block_size);
+			bit_pos = blocks[block] * 8;
+			bit_end = (block + 1 < blocks.size() ? blocks[block + 1] : index_pos) * 8;
+			std::fill(current, current + PIECES, BINARY_UNUSED);
+		}
+		int shared;
+		if (!GetBits(ARCHIVE_SHARED_BITS, shared) || shared > PIECES)
+			return false;
+		uint64_t covered = 0;
+		for (int block_index = 0; block_index < PIECES; block_index++)
+		{
+			if (block_index >= shared)
+			{
+				int count = codec->Candidates(block_index, covered, candidates.data()), value;
+				if (!GetBits(ArchiveCodec::Width(count), value) || value > count)
+					return false;
+				current[block_index] = value == 0 ? BINARY_UNUSED : candidates[value - 1];
+			}
+			covered |= codec->Mask(current[block_index]);
+		}
+		return true;
+	}
+
+	// 读取压缩格式的解数和段索引,检查段索引在文件中、严格递增并且段数与解数相符
+	bool OpenArchive(size_t offset)
+	{
+		uint64_t solution_count;
+		if (!ReadValue(offset, solution_count) || !ReadValue(offset, block_size) || !ReadValue(offset, index_pos) || block_size == 0)
+			return false;
+		uint64_t block_count = (solution_count + block_size - 1) / block_size;
+		if (index_pos < offset || index_pos > file.size() || file.size() - index_pos != block_count * sizeof(uint64_t))
+			return false;
+		size_t index_offset = (size_t)(index_pos);
+		uint64_t previous = offset;
+		for (uint64_t i = 0; i < block_count; i++)
+		{
+			uint64_t block = 0;
+			ReadValue(index_offset, block);
+			if (block < previous || block >= index_pos)
+				return false;
+			blocks.push_back(block);
+			previous = block + 1;
+		}
+		count = (long long)(solution_count);
+		codec = new ArchiveCodec(steps);
+		candidates.resize(steps.size());
+		return true;
+	}
+
+	template <class T>
+	bool ReadValue(size_t& offset, T& value) const
+	{
+		if (offset + sizeof(value) > file.size())
+			return false;
+		memcpy(&value, file.getData() + offset, sizeof(value));
+		offset += sizeof(value);
+		return true;
+	}
+
+public:
+	SolutionFile(const string& filename) : file(filename), count(0), solutions(NULL), archive(false), codec(NULL), block_size(0), index_pos(0), current_index(-1), bit_pos(0), bit_end(0) {}
+	~SolutionFile() { delete codec; }
+
+	// 读取文件头,文件不存在或格式不对时返回false
+	bool Open()
+	{
+		size_t offset = 0;
+		char magic[4];
+		uint32_t version, settings_size, row_count;
+		char type_name[8];
+		if (file.getData() == NULL || !ReadValue(offset, magic))
+			return false;
+		archive = memcmp(magic, ARCHIVE_MAGIC, sizeof(magic)) == 0;
+		if (!archive && memcmp(magic, BINARY_MAGIC, sizeof(magic)) != 0)
+			return false;
+		if (!ReadValue(offset, version) || version != BINARY_VERSION || !ReadValue(offset, type_name) || !ReadValue(offset, settings_size))
+			return false;
+		type_name[sizeof(type_name) - 1] = 0;
+		type = type_name;
+		if (settings_size > file.size() - offset)
+			return false;
+		settings.assign(file.getData() + offset, settings_size);
+		offset += settings_size;
+		if (!ReadValue(offset, row_count))
+			return false;
+
+		for (uint32_t row = 0; row < row_count; row++)
+		{
+			uint16_t block_index, shape_index, x, y, size;
+			if (!ReadValue(offset, block_index) || !ReadValue(offset, shape_index) || !ReadValue(offset, x) || !ReadValue(offset, y) || !ReadValue(offset, size))
+				return false;
+			if (block_index >= PIECES)
+				return false;
+			Step step(block_index, shape_index, x, y);
+			for (int i = 0; i < size; i++)
+			{
+				uint16_t index;
+				if (!ReadValue(offset, index))
+					return false;
+				step.indecies.push_back(index);
+			}
+			steps.push_back(step);
+		}
+		if (archive)
+			return OpenArchive(offset);
+
+		uint64_t solution_count;
+		if (!ReadValue(offset, solution_count) || (file.size() - offset) / (PIECES * sizeof(uint16_t)) < solution_count)
+			return false;
+		count = (long long)(solution_count);
+		solutions = reinterpret_cast<const uint16_t*>(file.getData() + offset);
+		for (long long i = 0; i < count * PIECES; i++)
+			if (solutions[i] != BINARY_UNUSED && (solutions[i] == 0 || solutions[i] > (int)(steps.size())))
+				return false;
+		return true;
+	}
+
+	const string& getType() const { return type; }
+	const string& getSettings() const { return settings; }
+	const vector<Step>& getSteps() const { return steps; }
+	long long size() const { return count; }
+
+	// 第i个解中每块积木所在的行号,未用到的积木为BINARY_UNUSED;压缩格式中所在的段数据不对时返回NULL
+	const uint16_t* Rows(long long i) const
+	{
+		if (!archive)
+			return solutions + i * PIECES;
+		if (i != current_index)
+		{
+			if (i < current_index || i / block_size != current_index / block_size)
+				current_index = i / block_size * block_size - 1;
+			while (current_index < i)
+				if (!DecodeNext())
+				{
+					current_index = -1;
+					return NULL;
+				}
+		}
+		return current;
+	}
+
+	// 第i个解,按积木序号排列;数据不对时返回false
+	bool Get(long long i, vector<Step>& solution) const
+	{
+		solution.clear();
+		const uint16_t* rows = Rows(i);
+		if (rows == NULL)
+			return false;
+		for (int block_index = 0; block_index < PIECES; block_index++)
+			if (rows[block_index] != BINARY_UNUSED)
+				solution.push_back(steps[rows[block_index] - 1]);
+		return true;
+	}
+};
+
+// 读出二进制格式的解文件,输出或统计满足所有条件的解
+// 条件的格式为"积木@位置",如"A@12"表示积木A占据第12个位置
+// unique为true时只保留每组互相对称的解中的代表
+int ReadSolutions(const string& input, const vector<string>& filters, bool unique, bool count_only, const string& output, int columns)
+{
+	SolutionFile file(input);
+	if (!file.Open())
+	{
+		std::cerr << input << " is not a solution file." << endl;
+		return 1;
+	}
+	IPattern* pattern = CreatePattern(file.getType());
+	if (pattern == NULL)
+	{
+		std::cerr << "Not a known type." << endl;
+		return 1;
+	}
+	std::cout << file.size() << " solution(s) in " << input << "." << endl;
+
+	// 每个条件满足时积木所在的行
+	const vector<Step>& steps = file.getSteps();
+	vector<int> filter_blocks;
+	vector<vector<bool> > filter_rows;
+	for (const string& filter : filters)
+	{
+		size_t at = filter.find('@');
+		int block_index = (int)(std::find(piece_map, piece_map + PIECES, filter.substr(0, at)) - piece_map);
+		int cell = at == string::npos ? 0 : atoi(filter.c_str() + at + 1);
+		if (block_index == PIECES || cell <= 0 || cell > pattern->size())
+		{
+			std::cerr << "Not a valid filter: " << filter << endl;
+			delete pattern;
+			return 1;
+		}
+		vector<bool> rows(steps.size() + 1, false);
+		for (int row = 1; row <= (int)(steps.size()); row++)
+			rows[row] = steps[row - 1].block_index == block_index
+				&& std::find(steps[row - 1].indecies.begin(), steps[row - 1].indecies.end(), cell) != steps[row - 1].indecies.end();
+		filter_blocks.push_back(block_index);
+		filter_rows.push_back(rows);
+	}
+
+	Symmetry* symmetry = NULL;
+	if (unique)
+	{
+		symmetry = new Symmetry(*pattern, steps, false);
+		PrintSymmetry(*symmetry);
+	}
+
+	std::ofstream fout;
+	if (!count_only && !output.empty())
+		fout.open(output, ios::out);
+	SolutionRenderer renderer(*pattern, steps, fout.is_open() ? (std::ostream&)(fout) : std::cout, !fout.is_open(), columns);
+	long long matched = 0;
+	vector<int> solution;
+	vector<Step> placed;
+	int result = 0;
+	// 只计数并且没有条件时不需要读出每个解
+	if (count_only && filter_blocks.empty() && symmetry == NULL)
+		matched = file.size();
+	for (long long i = matched; i < file.size(); i++)
+	{
+		const uint16_t* rows = file.Rows(i);
+		if (rows == NULL)
+		{
+			std::cerr << input << " is corrupt at solution " << i << "." << endl;
+			result = 1;
+			break;
+		}
+		bool match = true;
+		for (int j = 0; j < (int)(filter_blocks.size()) && match; j++)
+			match = rows[filter_blocks[j]] != BINARY_UNUSED && filter_rows[j][rows[filter_blocks[j]]];
+		if (match && symmetry != NULL)
+		{
+			solution.clear();
+			for (int block_index = 0; block_index < PIECES; block_index++)
+				if (rows[block_index] != BINARY_UNUSED)
+					solution.push_back(rows[block_index]);
+			match = symmetry->IsRepresentative(solution);
+		}
+		if (!match)
+			continue;
+		matched++;
+		if (count_only)
+			continue;
+		file.Get(i, placed);
+		renderer.Write(placed);
+	}
+	renderer.Finish();
+
+	if (result == 0)
+	{
+		if (fout.is_open())
+			fout << matched << " solution(s) found." << endl;
+		std::cout << matched << " solution(s) found." << endl;
+	}
+	delete symmetry;
+	delete pattern;
+	return result;
+}
+
+// 检查要合并的分片属于同一组,并且没有重复或缺少
+// 每个分片的设置每行一项,其中"shard i/N"给出分片的序号和数目,其余各行必须完全相同
+class ShardChecker
+{
+private:
+	string settings;
+	int shard_count;
+	vector<bool> seen;
+
+public:
+	ShardChecker() : shard_count(0) {}
+
+	// 加入一个分片的设置,与之前的分片不属于同一组或重复时返回false
+	bool Add(const string& file_settings)
+	{
+		std::istringstream in(file_settings);
+		string line, others;
+		int shard_index = -1, count = 0;
+		while (std::getline(in, line))
+		{
+			std::istringstream fields(line);
+			string key;
+			char slash = 0;
+			fields >> key;
+			if (key != "shard")
+				others += line + "\n";
+			else if (!(fields >> shard_index >> slash >> count) || slash != '/')
+				return false;
+		}
+		if (seen.empty())
+		{
+			if (count < 1)
+				return false;
+			settings = others;
+			shard_count = count;
+			seen.assign(count, false);
+		}
+		if (others != settings || count != shard_count || shard_index < 0 || shard_index >= shard_count || seen[shard_index])
+			return false;
+		seen[shard_index] = true;
+		return true;
+	}
+
+	// 缺少的分片数目
+	int Missing() const { return (int)(std::count(seen.begin(), seen.end(), false)); }
+	int size() const { return shard_count; }
+
+	// 合并后的结果相当于一次完整求解,分片为0/1
+	string Merged() const { return settings + "shard 0/1\n"; }
+};
+
+// 输出一个分片只计数时的结果,供--merge合并
+// settings为图案和影响分片的设置,每行一项
+void OutputShardCounts(std::ostream& out, const string& settings, const CountSink::Counter& total)
+{
+	out << "IQPyramidSolver counts 1" << endl;
+	out << settings;
+	out << "total " << total.total << endl;
+	for (unsigned int used = 0; used < total.subsets.size(); used++)
+		if (total.subsets[used] != 0)
+			out << "subset " << used << " " << total.subsets[used] << endl;
+}
+
+// 合并各个分片的计数文件,检查分片的设置相同并且没有重复或缺少
+int MergeCounts(const vector<string>& inputs, const string& output)
+{
+	CountSink::Counter total;
+	ShardChecker shards;
+	for (const string& input : inputs)
+	{
+		std::ifstream fin(input, ios::in);
+		string line, file_settings;
+		std::getline(fin, line);
+		while (std::getline(fin, line))
+		{
+			std::istringstream in(line);
+			string key;
+			in >> key;
+			if (key == "total")
+			{
+				long long value = 0;
+				in >> value;
+				total.total += value;
+			}
+			else if (key == "subset")
+			{
+				unsigned int used = 0;
+				long long value = 0;
+				in >> used >> value;
+				if (total.subsets.empty())
+					total.subsets.resize(1 << PIECES, 0);
+				if (used < total.subsets.size())
+					total.subsets[used] += value;
+			}
+			else
+				file_settings += line + "\n";
+		}
+		if (!shards.Add(file_settings))
+		{
+			std::cerr << input << " does not belong to the same set of shards, or is merged twice." << endl;
+			return 1;
+		}
+	}
+	if (shards.Missing() != 0)
+	{
+		std::cerr << shards.Missing() << " of " << shards.size() << " shard(s) missing, the total would be incomplete." << endl;
+		return 1;
+	}
+
+	OutputCounts(std::cout, total, vector<Step>(), vector<vector<int> >(), vector<long long>());
+	if (!output.empty())
+	{
+		std::ofstream fout(output, ios::out);
+		OutputCounts(fout, total, vector<Step>(), vector<vector<int> >(), vector<long long>());
+	}
+	return 0;
+}
+
+// 合并各个分片的结果
+// 二进制格式的解文件都已按输出顺序排列,每次从各文件当前的解中取出最小的一个,结果与一次求解完全相同;
+// 计数文件把各项相加
+int MergeResults(const vector<string>& inputs, const string& format, const string& output, int columns)
+{
+	vector<SolutionFile*> files;
+	for (const string& input : inputs)
+	{
+		files.push_back(new SolutionFile(input));
+		if (!files.back()->Open())
+		{
+			for (SolutionFile* file : files)
+				delete file;
+			if (files.size() == 1)
+				return MergeCounts(inputs, output);
+			std::cerr << input << " is not a solution file." << endl;
+			return 1;
+		}
+	}
+
+	int result = 0;
+	string type = files[0]->getType();
+	long long total = 0;
+	ShardChecker shards;
+	for (int i = 0; i < (int)(files.size()) && result == 0; i++)
+	{
+		if (files[i]->getType() != type)
+		{
+			std::cerr << inputs[i] << " is not a solution file of the same puzzle." << endl;
+			result = 1;
+		}
+		else if (!shards.Add(files[i]->getSettings()))
+		{
+			std::cerr << inputs[i] << " does not belong to the same set of shards, or is merged twice." << endl;
+			result = 1;
+		}
+		vector<Step> previous, current;
+		for (long long j = 0; j < files[i]->size() && result == 0; j++)
+		{
+			if (!files[i]->Get(j, current))
+			{
+				std::cerr << inputs[i] << " is corrupt at solution " << j << "." << endl;
+				result = 1;
+			}
+			else if (j > 0 && SolutionOrder(current, previous))
+			{
+				std::cerr << inputs[i] << " is not sorted, solutions written with --stream can not be merged." << endl;
+				result = 1;
+			}
+			previous.swap(current);
+		}
+		total += files[i]->size();
+	}
+	if (result == 0 && shards.Missing() != 0)
+	{
+		std::cerr << shards.Missing() << " of " << shards.size() << " shard(s) missing, the merged solutions would be incomplete." << endl;
+		result = 1;
+	}
+
+	IPattern* pattern = CreatePattern(type);
+	if (result == 0 && pattern != NULL)
+	{
+		std::ofstream fout;
+		BinaryWriter* writer = NULL;
+		if (!output.empty())
+		{
+			fout.open(output, format != "text" ? ios::out | ios::binary : ios::out);
+			if (format != "text")
+				writer = new BinaryWriter(fout, type, shards.Merged(), files[0]->getSteps(), format == "archive");
+			else
+				fout << total << " solution(s) found." << endl << endl;
+		}
+		SolutionRenderer renderer(*pattern, files[0]->getSteps(), fout.is_open() ? (std::ostream&)(fout) : std::cout, !fout.is_open(), columns);
+
+		// 各文件当前的解组成的堆,堆顶是最小的解;上面已经读过所有的解,不会再遇到不对的数据
+		typedef pair<vector<Step>, int> Head;
+		auto later = [](const Head& head1, const Head& head2) { return SolutionOrder(head2.first, head1.first); };
+		std::priority_queue<Head, vector<Head>, decltype(later)> heads(later);
+		vector<long long> next(files.size(), 0);
+		auto read = [&](int i) {
+			Head head(vector<Step>(), i);
+			files[i]->Get(next[i]++, head.first);
+			heads.push(head);
+		};
+		for (int i = 0; i < (int)(files.size()); i++)
+			if (files[i]->size() > 0)
+				read(i);
+		while (!heads.empty())
+		{
+			Head head = heads.top();
+			heads.pop();
+			if (writer != NULL)
+				writer->Write(head.first);
+			else
+				renderer.Write(head.first);
+			int i = head.second;
+			if (next[i] < files[i]->size())
+				read(i);
+		}
+		if (writer != NULL)
+			writer->Finish();
+		else
+			renderer.Finish();
+		delete writer;
+		std::cout << total << " solution(s) merged from " << files.size() << " file(s)." << endl;
+	}
+
+	delete pattern;
+	for (SolutionFile* file : files)
+		delete file;
+	return result;
+}
+
+// 基准测试的图案,以及各个图案已知的解的数目,用来核对求解结果
+static const string benchmark_types[] = { "t", "r", "p4", "p5" };
+static const long long benchmark_counts[] = { 32288, 371020, 184, 2448 };
+
+// 建立图案的关系矩阵
+template <class Steps>
+ISolver* BuildSolver(const IPattern& pattern, const Steps& steps, const string& engine, const string& layout)
+{
+	int node_count = PIECES + pattern.size() + 1;
+	for (const Step& step : steps)
+		node_count += (int)(step.indecies.size()) + 1;
+	int piece_node_count = 0;
+	for (int block_index = 0; block_index < PIECES; block_index++)
+		piece_node_count += Piece(Shapes.shapes[block_index][0], block_index, 0).size();
+
+	ISolver* solver = NULL;
+	if (engine == "bitboard")
+		solver = new BitboardSolver((int)(steps.size()), pattern.GetFillOrder());
+	else if (engine == "cells")
+		solver = new DancingCells((int)(steps.size()), pattern.size() + PIECES, pattern.size() == piece_node_count);
+	else if (engine == "zdd")
+	{
+		// 基准测试只计数
+		ZddSolver* zdd = new ZddSolver((int)(steps.size()), pattern.GetFillOrder(), pattern.size() == piece_node_count);
+		zdd->SetCounting(true, NULL);
+		solver = zdd;
+	}
+	else if (engine == "mitm")
+	{
+		MeetInTheMiddle* mitm = new MeetInTheMiddle((int)(steps.size()), pattern.GetFillOrder(), pattern.size() == piece_node_count, pattern.size() / 2);
+		mitm->SetCounting(true);
+		solver = mitm;
+	}
+	else
+		solver = CreateDancingLinkX(layout, node_count, (int)(steps.size()), pattern.size() + PIECES, pattern.size() == piece_node_count);
+	for (int i = 0; i < (int)(steps.size()); i++)
+	{
+		for (int index : steps[i].indecies)
+			solver->Link(i + 1, index);
+		solver->Link(i + 1, steps[i].block_index + pattern.size() + 1);
+	}
+	return solver;
+}
+
+// 由ZDD均匀地随机抽取sample_count个解
+void SampleSolutions(ZddSolver& zdd, int sample_count, unsigned int seed)
+{
+	std::mt19937_64 random(seed);
+	long long total = zdd.Sample(sample_count, random);
+	std::cout << "ZDD: " << zdd.NodeCount() << " node(s), " << zdd.StateCount() << " state(s), " << total << " solution(s), "
+		<< (total > 0 ? sample_count : 0) << " sampled." << endl;
+}
+
+double SecondsSince(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// 一次完整求解的结果
+struct BenchmarkRun
+{
+	int subtrees;
+	double split_seconds, solve_seconds;
+	long long nodes, solutions;
+};
+
+// 用threads个线程只计数地求解,level为0时自动分解子树,与main中静态分解的过程相同
+BenchmarkRun BenchmarkSolve(ISolver& solver, int level, int threads)
+{
+	BenchmarkRun run;
+	// counter只在本函数内有效,返回前恢复原来的设置,以免solver留下悬空的sink
+	ISolutionSink* previous_sink = solver.getSink();
+	const Symmetry* previous_symmetry = solver.getSymmetry();
+	bool previous_expand = solver.getExpand();
+	CountSink counter(false);
+	solver.SetSink(&counter, NULL, false);
+
+	auto start = chrono::steady_clock::now();
+	vector<vector<int> > steps_list;
+	vector<double> estimates;
+	if (level == 0)
+		SplitSubtrees(solver, threads, steps_list, estimates);
+	else
+	{
+		solver.Spread(0, level, steps_list);
+		estimates = EstimateSubtrees(solver, steps_list);
+	}
+	vector<int> order(steps_list.size());
+	for (int i = 0; i < (int)(order.size()); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](int i, int j) { return estimates[i] > estimates[j]; });
+	solver.TakeNodes();
+	run.subtrees = (int)(steps_list.size());
+	run.split_seconds = SecondsSince(start);
+
+	start = chrono::steady_clock::now();
+	SubtreeSolver subtrees(solver);
+#ifdef USING_TBB
+	tbb::atomic<long long> nodes = 0;
+	tbb::atomic<int> next = 0;
+	tbb::task_arena arena(threads);
+	arena.execute([&]() {
+		tbb::parallel_for(0, threads, [&](int) {
+			long long local = 0;
+			for (int k = next++; k < (int)(order.size()); k = next++)
+				local += subtrees.Solve(steps_list[order[k]]);
+			nodes += local;
+		});
+	});
+#else
+	long long nodes = 0;
+	for (int i : order)
+		nodes += subtrees.Solve(steps_list[i]);
+#endif
+	run.solve_seconds = SecondsSince(start);
+	run.nodes = nodes;
+	run.solutions = counter.Total().total;
+	solver.SetSink(previous_sink, previous_symmetry, previous_expand);
+	return run;
 }
 
-void DancingLinkX::Spread(int level, int level_needed, vector<vector<int>>& steps_list)
+// 基准测试:建立关系矩阵、选定和撤销一行(舞蹈链的Delete和Recover)、广度优先展开,以及各层次、各线程数下的完整求解,
+// 核对解的数目,结果写为JSON
+// engine可以是逗号分隔的多个引擎,依次在同样的图案和设置下测试,并比较各引擎最快一次求解的时间
+int RunBenchmark(const string& output, const string& type, const vector<int>& levels, const string& engine, const string& layout)
 {
-	if (level >= level_needed)
+	vector<string> engines;
+	std::istringstream engine_list(engine);
+	for (string name; std::getline(engine_list, name, ',');)
 	{
-		vector<int> steps = vector<int>(Answer);
-		steps_list.push_back(steps);
-		return;
-	}
-	int now = Right[0];
-	int least_count = INT_MAX;
-	for (int i = Right[0]; i != 0 && i <= max_column; i = Right[i])
-		if (Count[i] < least_count)
+		if (name != "dlx" && name != "bitboard" && name != "cells" && name != "zdd" && name != "mitm")
 		{
-			least_count = Count[i];
-			now = i;
+			std::cerr << "Not a known engine." << endl;
+			return 1;
 		}
-	Delete(now);
-	for (int i = Down[now]; i != now; i = Down[i])
+		engines.push_back(name);
+	}
+	if (engines.empty())
 	{
-		Answer.push_back(Row[i]);
-		for (int j = Right[i]; j != i; j = Right[j])
-			Delete(Column[j]);
-
-		Spread(level + 1, level_needed, steps_list);
-
-		for (int j = Left[i]; j != i; j = Left[j])
-			Recover(Column[j]);
-		Answer.pop_back();
+		std::cerr << "Not a known engine." << endl;
+		return 1;
 	}
-	Recover(now);
-	return;
-}
-
-void DancingLinkX::Dance()
-{
-	int now = Right[0];
-	if (now == 0 || now > max_column)
+	if (layout != "separate" && layout != "interleaved" && layout != "compact")
 	{
-		vector<int> result = vector<int>(Answer);
-		Answers.push_back(result);
-		return;
+		std::cerr << "Not a known layout." << endl;
+		return 1;
 	}
-	int least_count = INT_MAX;
-	for (int i = Right[0]; i != 0 && i <= max_column; i = Right[i])
-		if (Count[i] < least_count)
-		{
-			least_count = Count[i];
-			now = i;
-		}
-	Delete(now);
-	for (int i = Down[now]; i != now; i = Down[i])
+	vector<string> types;
+	for (const string& known : benchmark_types)
+		if (type.empty() || type == known)
+			types.push_back(known);
+	if (types.empty())
 	{
-		Answer.push_back(Row[i]);
-		for (int j = Right[i]; j != i; j = Right[j])
-			Delete(Column[j]);
+		std::cerr << "Not a known type." << endl;
+		return 1;
+	}
 
-		Dance();
+	// 线程数从1开始倍增,最后一项为全部核心
+	vector<int> thread_counts;
+#ifdef USING_TBB
+	int max_threads = tbb::this_task_arena::max_concurrency();
+	for (int threads = 1; threads < max_threads; threads *= 2)
+		thread_counts.push_back(threads);
+	thread_counts.push_back(max_threads);
+#else
+	thread_counts.push_back(1);
+#endif
 
-		for (int j = Left[i]; j != i; j = Left[j])
-			Recover(Column[j]);
-		Answer.pop_back();
+	std::ofstream fout(output, ios::out);
+	if (!fout)
+	{
+		std::cerr << "Can not open " << output << "." << endl;
+		return 1;
 	}
-	Recover(now);
-	return;
-}
+	fout << "{" << endl;
+	fout << "  \"engine\": \"" << engine << "\"," << endl;
+	fout << "  \"layout\": \"" << layout << "\"," << endl;
+	fout << "  \"max_threads\": " << thread_counts.back() << "," << endl;
+	fout << "  \"patterns\": [" << endl;
 
-// 输出结果到控制台,不同积木用不同颜色表示
-void OutputToConsole(const vector<vector<int> >& matrix)
-{
-	for (vector<int> line : matrix)
+	bool all_ok = true;
+	vector<vector<double> > best(types.size(), vector<double>(engines.size(), 0));
+	for (int t = 0; t < (int)(types.size()); t++)
 	{
-		for (int block_index : line)
-			if (block_index == -1)
-				std::cout << " ";
-			else
-			{
-#if defined(_WIN32) || defined(_WIN64)
-				CONSOLE_SCREEN_BUFFER_INFO csbiInfo;
-				HANDLE handle = GetStdHandle(STD_OUTPUT_HANDLE);
-				GetConsoleScreenBufferInfo(handle, &csbiInfo);
-				WORD wOldColorAttrs = csbiInfo.wAttributes;
-				SetConsoleTextAttribute(handle, console_color[block_index]);
-				std::cout << piece_map[block_index];
-				SetConsoleTextAttribute(handle, wOldColorAttrs);
+		for (int e = 0; e < (int)(engines.size()); e++)
+		{
+			IPattern* pattern = CreatePattern(types[t]);
+			long long expected = benchmark_counts[std::find(benchmark_types, benchmark_types + 4, types[t]) - benchmark_types];
+
+			// 按积木和形状的顺序依次求出所有位置,行的顺序固定
+#ifdef USING_TBB
+			tbb::concurrent_vector<Step> steps;
 #else
-				std::cout << ansi_color[block_index] << piece_map[block_index] << ansi_color[PIECES];
+			vector<Step> steps;
 #endif
+			for (int block_index = 0; block_index < PIECES; block_index++)
+				for (int shape_index = 0; shape_index < Shapes.count[block_index]; shape_index++)
+				{
+					Piece piece(Shapes.shapes[block_index][shape_index], block_index, shape_index);
+					pattern->GetValidSteps(piece, steps);
+				}
+			long long links = 0;
+			for (const Step& step : steps)
+				links += (long long)(step.indecies.size()) + 1;
+
+			// 建立关系矩阵,每次Link的平均时间
+			long long repeats = 0;
+			auto start = chrono::steady_clock::now();
+			do
+			{
+				delete BuildSolver(*pattern, steps, engines[e], layout);
+				repeats++;
+			} while (SecondsSince(start) < BENCHMARK_TIME);
+			double link_ns = SecondsSince(start) * 1e9 / (repeats * links);
+
+			// 依次选定和撤销每一行,每次的平均时间
+			ISolver* solver = BuildSolver(*pattern, steps, engines[e], layout);
+			long long covers = 0;
+			start = chrono::steady_clock::now();
+			do
+			{
+				for (int row = 1; row <= (int)(steps.size()); row++)
+				{
+					solver->KnownStep(row);
+					solver->UndoStep();
+				}
+				covers += steps.size();
+			} while (SecondsSince(start) < BENCHMARK_TIME);
+			double cover_ns = SecondsSince(start) * 1e9 / covers;
+
+			std::cout << types[t] << " " << engines[e] << ": " << steps.size() << " rows, link " << link_ns << " ns, cover " << cover_ns << " ns" << endl;
+			fout << "    {" << endl;
+			fout << "      \"type\": \"" << types[t] << "\"," << endl;
+			fout << "      \"engine\": \"" << engines[e] << "\"," << endl;
+			fout << "      \"rows\": " << steps.size() << "," << endl;
+			fout << "      \"links\": " << links << "," << endl;
+			fout << "      \"link_ns\": " << link_ns << "," << endl;
+			fout << "      \"cover_ns\": " << cover_ns << "," << endl;
+
+			// 广度优先展开到各层
+			fout << "      \"spread\": [" << endl;
+			for (int level = 1; level <= BENCHMARK_SPREAD_MAX; level++)
+			{
+				vector<vector<int> > steps_list;
+				start = chrono::steady_clock::now();
+				solver->Spread(0, level, steps_list);
+				double seconds = SecondsSince(start);
+				fout << "        { \"level\": " << level << ", \"subtrees\": " << steps_list.size() << ", \"seconds\": " << seconds << " }"
+					<< (level < BENCHMARK_SPREAD_MAX ? "," : "") << endl;
 			}
-		std::cout << endl;
-	}
-	std::cout << endl;
-}
+			fout << "      ]," << endl;
 
-// 输出结果到文件,不需要彩色文本
-void OutputToFile(const vector<vector<int> >& matrix, std::ofstream& fout)
-{
-	for (vector<int> line : matrix)
-	{
-		for (int block_index : line)
-			if (block_index == -1)
-				fout << " ";
-			else
-				fout << piece_map[block_index];
-		fout << endl;
+			// 各层次、各线程数下的完整求解
+			fout << "      \"solve\": [" << endl;
+			for (int l = 0; l < (int)(levels.size()); l++)
+				for (int k = 0; k < (int)(thread_counts.size()); k++)
+				{
+					BenchmarkRun run = BenchmarkSolve(*solver, levels[l], thread_counts[k]);
+					bool ok = run.solutions == expected;
+					all_ok = all_ok && ok;
+					double seconds = run.split_seconds + run.solve_seconds;
+					if (best[t][e] == 0 || seconds < best[t][e])
+						best[t][e] = seconds;
+					std::cout << types[t] << " " << engines[e] << ": level " << levels[l] << ", " << thread_counts[k] << " thread(s), " << run.subtrees << " subtree(s), "
+						<< seconds << " seconds, " << run.solutions << " solution(s)" << (ok ? "" : " MISMATCH") << endl;
+					fout << "        { \"level\": " << levels[l] << ", \"threads\": " << thread_counts[k] << ", \"subtrees\": " << run.subtrees
+						<< ", \"split_seconds\": " << run.split_seconds << ", \"solve_seconds\": " << run.solve_seconds << ", \"seconds\": " << seconds
+						<< ", \"nodes\": " << run.nodes << ", \"nodes_per_second\": " << (seconds > 0 ? run.nodes / seconds : 0)
+						<< ", \"solutions\": " << run.solutions << ", \"expected\": " << expected << ", \"ok\": " << (ok ? "true" : "false") << " }"
+						<< (l + 1 < (int)(levels.size()) || k + 1 < (int)(thread_counts.size()) ? "," : "") << endl;
+				}
+			fout << "      ]" << endl;
+			fout << "    }" << (t + 1 < (int)(types.size()) || e + 1 < (int)(engines.size()) ? "," : "") << endl;
+
+			delete solver;
+			delete pattern;
+		}
 	}
-	fout << endl;
+
+	fout << "  ]," << endl;
+
+	// 以第一个引擎为基准,比较各引擎最快一次求解的时间
+	fout << "  \"comparison\": [" << endl;
+	for (int t = 0; t < (int)(types.size()); t++)
+		for (int e = 0; e < (int)(engines.size()); e++)
+		{
+			double relative = best[t][0] > 0 ? best[t][e] / best[t][0] : 0;
+			if (engines.size() > 1)
+				std::cout << types[t] << " " << engines[e] << ": best " << best[t][e] << " seconds, " << relative << " x " << engines[0] << endl;
+			fout << "    { \"type\": \"" << types[t] << "\", \"engine\": \"" << engines[e] << "\", \"best_seconds\": " << best[t][e]
+				<< ", \"relative\": " << relative << " }" << (t + 1 < (int)(types.size()) || e + 1 < (int)(engines.size()) ? "," : "") << endl;
+		}
+	fout << "  ]," << endl;
+	fout << "  \"ok\": " << (all_ok ? "true" : "false") << endl;
+	fout << "}" << endl;
+	std::cout << "Benchmark written to " << output << "." << endl;
+	return all_ok ? 0 : 1;
 }
 
 int main(int argc, const char *argv[])
 {
 	// 提取和处理命令行参数
-	string type, filename;
-	int level;
+	string type, filename, engine, symmetry_mode, split, layout, format, input, benchmark, stats_file, checkpoint_file, shard;
+	vector<string> filters, merge_inputs;
+	int level, memo, zdd_memo, sample_count, cut, columns;
+	unsigned int seed;
+	bool count_only, breakdown, stream, prune;
 	bpo::options_description desc("Allowed options");
 	desc.add_options()("help,h", "display help message")
 		("type,t", bpo::value<string>(&type), "the puzzle pattern type : [t|r|p4|p5]\nt: Triangle Pattern\nr: Rectangle Pattern\np4: 4 Level Pyramid Pattern\np5: 5 Level Pyramid Pattern")
 		("output,o", bpo::value<string>(&filename), "output filename\nif not set, output to console")
-		("level,l", bpo::value<int>(&level)->default_value(FACTOR), "spread level for parallelize: [1--12]")
+		("level,l", bpo::value<int>(&level)->default_value(0), "spread level for parallelize: [0--12]\n0: choose by estimated subtree sizes")
+		("split", bpo::value<string>(&split)->default_value("static"), "how to split the search tree for parallelize : [static|dynamic]\nstatic: spread to the given level before solving\ndynamic: running solvers donate untried branches to idle threads")
+		("engine,e", bpo::value<string>(&engine)->default_value("dlx"), "the exact cover engine : [dlx|bitboard|cells|zdd|mitm]\ndlx: Dancing Links\nbitboard: 64 bit masks, fill the first empty cell\ncells: Dancing Cells, sparse sets with swap deletion\nzdd: 64 bit masks, solve each state of covered positions and used pieces once and keep the solutions as a ZDD\nmitm: meet in the middle, enumerate the two halves cut by --cut and join them, for patterns using all pieces\nwith --benchmark, several engines separated by commas, like dlx,cells")
+		("layout", bpo::value<string>(&layout)->default_value("separate"), "node storage of the dlx engine : [separate|interleaved|compact]\nseparate: one int array for each field\ninterleaved: one struct of ints for each node\ncompact: interleaved with 16 bit indices, falls back to int for large matrices")
+		("symmetry,s", bpo::value<string>(&symmetry_mode)->default_value("all"), "symmetric solutions : [all|unique|expand|canonical]\nall: search and output all solutions\nunique: search only one solution of each symmetric group\nexpand: search as unique, then output all solutions\ncanonical: search all solutions, keep only the smallest one of each symmetric group\nwith --read, unique and canonical keep only the smallest one of each symmetric group")
+		("count-only,c", bpo::bool_switch(&count_only), "only count the solutions, do not keep them")
+		("breakdown,b", bpo::bool_switch(&breakdown), "with --count-only, also count the solutions of each partial solution spread to the given level, and of each set of used pieces if not all pieces are used")
+		("stream", bpo::bool_switch(&stream), "write solutions to the output file while searching, unsorted")
+		("prune", bpo::bool_switch(&prune), "cut the branches leaving an empty region that the remaining pieces can not fill, for patterns of at most 64 positions")
+		("memo", bpo::value<int>(&memo), "with --engine zdd and --count-only, count with a transposition table of the given size in MB instead of keeping the ZDD")
+		("zdd-memo", bpo::value<int>(&zdd_memo)->default_value(64), "with --engine zdd, the memory in MB of the states remembered by each thread, rounded down to a power of 2, 0 to remember none; ZDD nodes of replaced states stay until the current subtree is solved, and the ZDD is dropped between subtrees once it has more nodes than remembered states")
+		("sample", bpo::value<int>(&sample_count)->default_value(0), "with --engine zdd, output the given number of solutions drawn uniformly at random from the ZDD instead of all solutions")
+		("seed", bpo::value<unsigned int>(&seed)->default_value(1), "random seed of --sample")
+		("cut", bpo::value<int>(&cut)->default_value(0), "with --engine mitm, the number of positions of the first half in the fill order\n0: half of the positions")
+		("format,f", bpo::value<string>(&format)->default_value("text"), "output file format : [text|binary|archive]\ntext: draw each solution with letters\nbinary: the row of each piece, readable with --read\narchive: binary with each solution coded by its difference from the previous one, in blocks with an index, readable with --read")
+		("columns", bpo::value<int>(&columns)->default_value(1), "draw the given number of solutions side by side in the console and text output")
+		("read,r", bpo::value<string>(&input), "read solutions from a binary or archive file instead of solving, output to console or the output file")
+		("filter", bpo::value<vector<string> >(&filters)->composing(), "with --read, keep only solutions with a piece covering a position, like A@12")
+		("shard", bpo::value<string>(&shard), "solve only part i of N of the subtrees, 0 <= i < N, like 0/4, and write the counts or the sorted binary solutions to the output file for --merge; all parts must use the same --engine and --level")
+		("merge", bpo::value<vector<string> >(&merge_inputs)->multitoken(), "merge the output files of all parts of --shard, output to console or the output file")
+		("checkpoint", bpo::value<string>(&checkpoint_file), "record the subtrees and the solutions of each completed subtree in the given file, resume from it if it exists")
+		("stats", bpo::value<string>(&stats_file), "write the time of each phase to the given json file, and the nodes, branching and updates of each search level when built with USING_STATS")
+		("benchmark", bpo::value<string>(&benchmark), "run the benchmark on the given --type or all types, at the given --level or levels 0--3, with 1, 2, 4 ... threads, write the results to the given json file")
 		;
 
 	bpo::variables_map vm;
@@ -791,6 +4963,27 @@ int main(int argc, const char *argv[])
 		return 0;
 	}
 
+	if (vm.count("read"))
+		return ReadSolutions(input, filters, symmetry_mode == "unique" || symmetry_mode == "canonical", count_only, vm.count("output") ? filename : string(), columns);
+
+	if (vm.count("merge"))
+		return MergeResults(merge_inputs, format, vm.count("output") ? filename : string(), columns);
+
+	if (vm.count("benchmark"))
+	{
+		if (level < 0 || level > 12)
+		{
+			std::cout << "level should between 0 and 12." << endl;
+			return 0;
+		}
+		vector<int> levels;
+		if (vm["level"].defaulted())
+			levels = { 0, 1, 2, 3 };
+		else
+			levels.push_back(level);
+		return RunBenchmark(benchmark, type, levels, engine, layout);
+	}
+
 	IPattern * pattern = NULL;
 	if (vm.count("type"))
 	{
@@ -829,64 +5022,159 @@ int main(int argc, const char *argv[])
 
 	if (vm.count("level"))
 	{
-		if (level < 1 || level > 12)
+		if (level < 0 || level > 12)
 		{
-			std::cout << "level should between 1 and 12." << endl;
+			std::cout << "level should between 0 and 12." << endl;
 			return 0;
 		}
 	}
-	std::cout << "Spread Level: " << level << endl;
+	if (engine != "dlx" && engine != "bitboard" && engine != "cells" && engine != "zdd" && engine != "mitm")
+	{
+		std::cerr << "Not a known engine." << endl;
+		std::cerr << endl << desc << endl << endl;
+		return 1;
+	}
+	if (symmetry_mode != "all" && symmetry_mode != "unique" && symmetry_mode != "expand" && symmetry_mode != "canonical")
+	{
+		std::cerr << "Not a known symmetry mode." << endl;
+		std::cerr << endl << desc << endl << endl;
+		return 1;
+	}
+	if (layout != "separate" && layout != "interleaved" && layout != "compact")
+	{
+		std::cerr << "Not a known layout." << endl;
+		std::cerr << endl << desc << endl << endl;
+		return 1;
+	}
+	if (split != "static" && split != "dynamic")
+	{
+		std::cerr << "Not a known split mode." << endl;
+		std::cerr << endl << desc << endl << endl;
+		return 1;
+	}
+	if (format != "text" && format != "binary" && format != "archive")
+	{
+		std::cerr << "Not a known format." << endl;
+		std::cerr << endl << desc << endl << endl;
+		return 1;
+	}
+	if (stream && !vm.count("output"))
+	{
+		std::cerr << "--stream needs an output file." << endl;
+		std::cerr << endl << desc << endl << endl;
+		return 1;
+	}
+	int shard_index = 0, shard_count = 1;
+	if (vm.count("shard"))
+	{
+		std::istringstream in(shard);
+		char slash = 0;
+		if (!(in >> shard_index >> slash >> shard_count) || slash != '/' || shard_count < 1 || shard_index < 0 || shard_index >= shard_count)
+		{
+			std::cerr << "Not a valid shard." << endl;
+			std::cerr << endl << desc << endl << endl;
+			return 1;
+		}
+		if (!vm.count("output") || stream || (!count_only && format == "text"))
+		{
+			std::cerr << "--shard needs an output file, with --count-only or --format binary or archive, and no --stream." << endl;
+			std::cerr << endl << desc << endl << endl;
+			return 1;
+		}
+		if (split == "dynamic")
+		{
+			std::cout << "--shard needs fixed subtrees, using static split." << endl;
+			split = "static";
+		}
+	}
+	if (count_only)
+		stream = false;
+	if (sample_count > 0 && (engine != "zdd" || count_only || stream || vm.count("checkpoint") || vm.count("shard") || (symmetry_mode != "all" && symmetry_mode != "unique")))
+	{
+		std::cerr << "--sample needs --engine zdd and --symmetry all or unique, without --count-only, --stream, --checkpoint or --shard." << endl;
+		std::cerr << endl << desc << endl << endl;
+		return 1;
+	}
+	if (vm.count("memo") && (engine != "zdd" || !count_only || memo < 1))
+	{
+		std::cout << "--memo needs --engine zdd, --count-only and a size of at least 1 MB, ignored." << endl;
+		vm.erase("memo");
+	}
+	if (zdd_memo < 0)
+	{
+		std::cout << "--zdd-memo needs a size of at least 0 MB, using 64 MB." << endl;
+		zdd_memo = 64;
+	}
+	if (engine == "mitm" && vm.count("shard"))
+	{
+		std::cerr << "--engine mitm solves the whole pattern at once, can not be used with --shard." << endl;
+		return 1;
+	}
+	if (engine == "mitm" && split == "dynamic")
+	{
+		std::cout << "--engine mitm solves the whole pattern at once, using static split." << endl;
+		split = "static";
+	}
+	if (vm.count("checkpoint") && split == "dynamic")
+	{
+		std::cout << "--checkpoint needs fixed subtrees, using static split." << endl;
+		split = "static";
+	}
+#ifndef USING_TBB
+	split = "static";
+#endif
+	// 图案和影响分片的设置,写入分片的计数文件和二进制格式的解文件,--merge时检查
+	std::ostringstream shard_settings;
+	shard_settings << "type " << type << "\nsymmetry " << symmetry_mode << "\nengine " << engine << "\nlevel " << level
+		<< "\nshard " << shard_index << "/" << shard_count << "\n";
+	if (split == "dynamic")
+		std::cout << "Spread Level: dynamic" << endl;
+	else if (level != 0)
+		std::cout << "Spread Level: " << level << endl;
+	std::cout << "Engine: " << engine << endl;
 
 	// 开始计时
 	auto start = chrono::system_clock::now();
+	PhaseTimer timer;
 
 	// 初始化所有的积木数据
 	vector<Piece> pieces;
 	int piece_node_count = 0;
 	for (int block_index = 0; block_index < PIECES; block_index++)
 	{
-		Piece piece(PieceData[block_index], block_index);
-		pieces.push_back(piece);
-		piece_node_count += piece.size();
-		switch (rotates[block_index])
-		{
-		case 8:
-			for (int i = 0; i < 3; i++)
-			{
-				piece.Rotate();
-				pieces.emplace_back(piece);
-			}
-			piece.Flip();
-			pieces.emplace_back(piece);
-			for (int i = 0; i < 3; i++)
-			{
-				piece.Rotate();
-				pieces.emplace_back(piece);
-			}
-			break;
-		case 4:
-			for (int i = 0; i < 3; i++)
-			{
-				piece.Rotate();
-				pieces.emplace_back(piece);
-			}
-			break;
-		case 2:
-			piece.Rotate();
-			pieces.emplace_back(piece);
-			break;
-		case 1:
-		default:
-			break;
-		}
+		for (int shape_index = 0; shape_index < Shapes.count[block_index]; shape_index++)
+			pieces.emplace_back(Shapes.shapes[block_index][shape_index], block_index, shape_index);
+		piece_node_count += pieces.back().size();
+	}
+	timer.Mark("pieces");
+
+	// 剪去留下无法填满的空白区域的分支
+	RegionPruner* pruner = NULL;
+	if (prune)
+	{
+		if (pattern->size() <= 64)
+			pruner = new RegionPruner(*pattern);
+		else
+			std::cout << "pruning needs a pattern of at most 64 positions, ignored." << endl;
 	}
 
+	// 折半搜索默认从填充顺序的中间分开
+	if (cut <= 0)
+		cut = pattern->size() / 2;
+
+	// zdd引擎只计数时可以改用置换表,占用的内存有上限
+	TranspositionTable* table = NULL;
+	if (vm.count("memo"))
+		table = new TranspositionTable(memo);
+
 #ifdef USING_TBB
 	// 使用TBB,并行执行
 
 	// 获得每块积木的每个形状在图案中的每个可能的位置
 	tbb::concurrent_vector<Step> steps;
 	tbb::parallel_for_each(pieces.begin(), pieces.end(), [&](Piece& piece) { pattern->GetValidSteps(piece, steps); });
+	tbb::parallel_sort(steps.begin(), steps.end(), StepOrder);
+	timer.Mark("steps");
 
 	// 计算舞蹈链数据结构初始化所需的节点数目
 	int node_count = 0;
@@ -899,22 +5187,94 @@ int main(int argc, const char *argv[])
 
 	// 初始化舞蹈链数据结构
 	// 构造关系矩阵
-	DancingLinkX dlx(node_count, (int)(steps.size()), (int)(pattern->size()) + PIECES, ((int)(pattern->size()) == piece_node_count));
-	for (int i = 0; i < steps.size(); i++)
+	ISolver* solver = NULL;
+	ZddSolver* zdd = NULL;
+	MeetInTheMiddle* mitm = NULL;
+	if (engine == "bitboard")
+		solver = new BitboardSolver((int)(steps.size()), pattern->GetFillOrder());
+	else if (engine == "cells")
+		solver = new DancingCells((int)(steps.size()), (int)(pattern->size()) + PIECES, ((int)(pattern->size()) == piece_node_count));
+	else if (engine == "zdd")
+	{
+		solver = zdd = new ZddSolver((int)(steps.size()), pattern->GetFillOrder(), ((int)(pattern->size()) == piece_node_count));
+		zdd->SetMemo(zdd_memo);
+	}
+	else if (engine == "mitm")
+		solver = mitm = new MeetInTheMiddle((int)(steps.size()), pattern->GetFillOrder(), ((int)(pattern->size()) == piece_node_count), cut);
+	else
+		solver = CreateDancingLinkX(layout, node_count, (int)(steps.size()), (int)(pattern->size()) + PIECES, ((int)(pattern->size()) == piece_node_count));
+	solver->SetPruner(pruner);
+
+	// 依据图案的对称性,限制一块积木的位置
+	Symmetry* symmetry = NULL;
+	if (symmetry_mode != "all")
+	{
+		symmetry = new Symmetry(*pattern, steps, symmetry_mode != "canonical");
+		PrintSymmetry(*symmetry);
+	}
+
+	for (int i = 0; i < (int)(steps.size()); i++)
 	{
+		if (symmetry != NULL && !symmetry->Keep(i + 1))
+			continue;
 		for (int index : steps[i].indecies)
-			dlx.Link(i + 1, index);
-		dlx.Link(i + 1, steps[i].block_index + pattern->size() + 1);
+			solver->Link(i + 1, index);
+		solver->Link(i + 1, steps[i].block_index + pattern->size() + 1);
 	}
+	timer.Mark("matrix");
 
-	vector<vector<int> > steps_list;
+	// 保存所有的解,或只计数,或边搜索边输出
+	SolutionKeys keys(steps);
+	CollectSink collector(keys, symmetry);
+	CountSink counter(breakdown && (int)(pattern->size()) != piece_node_count);
+	std::ofstream stream_out;
+	BinaryWriter* stream_binary = NULL;
+	StreamSink<tbb::concurrent_vector<Step> >* streamer = NULL;
+	if (stream)
+	{
+		stream_out.open(filename, format != "text" ? ios::out | ios::binary : ios::out);
+		if (format != "text")
+			stream_binary = new BinaryWriter(stream_out, type, shard_settings.str(), steps, format == "archive");
+		streamer = new StreamSink<tbb::concurrent_vector<Step> >(*pattern, steps, symmetry, stream_out, stream_binary);
+	}
+	ISolutionSink* sink = &collector;
+	if (count_only)
+		sink = &counter;
+	else if (stream)
+		sink = streamer;
+
+	// 记录检查点时,子树完成后才把其中的解交给sink
+	Checkpoint* checkpoint = NULL;
+	std::ostringstream header;
+	header << "IQPyramidSolver checkpoint 1\ntype " << type << "\nsymmetry " << symmetry_mode
+		<< "\nmode " << (count_only ? "count" : "solutions") << "\nrows " << steps.size() << "\nshard " << shard_index << "/" << shard_count << "\n";
+	if (vm.count("checkpoint"))
+	{
+		checkpoint = new Checkpoint(checkpoint_file, *sink, count_only);
+		sink = checkpoint;
+	}
+	solver->SetSink(sink, symmetry, symmetry_mode == "expand");
+	if (zdd != NULL)
+		zdd->SetCounting(count_only, table);
+	if (mitm != NULL)
+		mitm->SetCounting(count_only);
 
-	// 广度优先遍历,展开解空间树为一系列子树,供并行处理
-	dlx.Spread(0, level, steps_list);
+	vector<vector<int> > steps_list;
+	vector<long long> prefix_counts;
+	SubtreeSolver subtrees(*solver);
 
-	tbb::concurrent_vector<vector<int> > results;
-	tbb::atomic<int> count = 0;
-	tbb::spin_mutex mtx;
+	// 从检查点继续时使用其中记录的子树
+	if (checkpoint != NULL)
+	{
+		if (!checkpoint->Load(header.str(), steps_list))
+		{
+			std::cerr << checkpoint_file << " is a checkpoint of another puzzle or settings." << endl;
+			return 1;
+		}
+		if (!steps_list.empty())
+			std::cout << "Resuming from checkpoint: " << checkpoint->Completed() << " of " << steps_list.size() << " subtree(s) completed." << endl;
+	}
+	solver->TakeNodes();
 
 	// 隐藏控制台光标,防止显示进度时光标闪烁
 #if defined(_WIN32) || defined(_WIN64)
@@ -928,53 +5288,104 @@ int main(int argc, const char *argv[])
 	cout << "\033[?25l" << flush;
 #endif
 
-	// 并行求解
-	tbb::parallel_for_each(steps_list.begin(), steps_list.end(), [&](vector<int> steps) {
-		DancingLinkX clone(dlx);
-		for (int step : steps)
-			clone.KnownStep(step);
-		clone.Dance();
-		for (vector<int> solution : clone.getResult())
-			results.push_back(solution);
+	if (sample_count > 0)
+	{
+		SampleSolutions(*zdd, sample_count, seed);
+		timer.Mark("solve");
+	}
+	else if (split == "dynamic")
+	{
+		// 动态分解子树,并行求解;不事先分解子树,进度只能按整棵树的估计大小计算
+		std::mt19937 random(1);
+		Progress progress(EstimateSubtree(*solver, PROBES * PROBES, random));
+		timer.Mark("split");
+		solver->SetProgress(&progress);
+		TaskPool pool(subtrees);
+		solver->SetTaskPool(&pool, SPLIT_DEPTH);
+		pool.Run();
+		solver->SetTaskPool(NULL, 0);
+		progress.Stop();
+		timer.Mark("solve");
+	}
+	else
+	{
+		// 广度优先遍历,展开解空间树为一系列子树,供并行处理;或依据估计的大小分解
+		int threads = tbb::this_task_arena::max_concurrency();
+		vector<double> estimates;
+		if (!steps_list.empty())
+			estimates = EstimateSubtrees(*solver, steps_list);
+		else if (engine == "mitm")
+		{
+			// 折半搜索一次求出所有的解,不分解子树,也无法估计进度
+			steps_list.push_back(vector<int>());
+			estimates.push_back(0);
+		}
+		else
+		{
+			if (level == 0)
+			{
+				SplitSubtrees(*solver, vm.count("shard") ? shard_count * SHARD_THREADS : threads, steps_list, estimates);
+				std::cout << "\rSpread Level: auto, " << steps_list.size() << " subtree(s)" << endl;
+			}
+			else
+			{
+				solver->Spread(0, level, steps_list);
+				estimates = EstimateSubtrees(*solver, steps_list);
+			}
+			if (vm.count("shard"))
+			{
+				SelectShard(steps_list, estimates, shard_index, shard_count);
+				std::cout << "Shard " << shard_index << "/" << shard_count << ": " << steps_list.size() << " subtree(s)" << endl;
+			}
+		}
+		if (checkpoint != NULL)
+			checkpoint->Start(header.str(), steps_list);
+		if (count_only && breakdown)
+			prefix_counts.resize(steps_list.size(), 0);
 
-		// 显示进度
-		int x = (++count) * 100 / (int)(steps_list.size());
-		tbb::spin_mutex::scoped_lock lock(mtx);
-		std::cout << "\r" << x << "% completed." << flush;
-	});
+		// 按估计的子树大小从大到小排列,最大的子树最先开始求解,避免最后只剩一个大子树在求解
+		vector<int> order(steps_list.size());
+		for (int i = 0; i < (int)(order.size()); i++)
+			order[i] = i;
+		std::stable_sort(order.begin(), order.end(), [&](int i, int j) { return estimates[i] > estimates[j]; });
+		timer.Mark("split");
+
+		// 并行求解,每个线程依次取出下一个子树;进度按子树的估计大小加权
+		Progress progress(std::accumulate(estimates.begin(), estimates.end(), 0.0));
+		solver->SetProgress(&progress);
+		tbb::atomic<int> next = 0;
+		tbb::parallel_for(0, threads, [&](int) {
+			for (int k = next++; k < (int)(order.size()); k = next++)
+			{
+				int i = order[k];
+				// 每个子树都在一个线程中求解完成,当前线程计数的增量就是子树中解的数目
+				long long before = counter.Local().total;
+				long long nodes = 0;
+				if (checkpoint == NULL || !checkpoint->Done(i))
+					nodes = subtrees.Solve(steps_list[i]);
+				if (checkpoint != NULL)
+					checkpoint->Commit(i);
+				collector.Seal();
+				if (!prefix_counts.empty())
+					prefix_counts[i] = counter.Local().total - before;
+				progress.Finish(estimates[i], nodes);
+			}
+		});
+		progress.Stop();
+		timer.Mark("solve");
+	}
 
 	// 恢复控制台光标显示
 #if defined(_WIN32) || defined(_WIN64)
 	cci.bVisible = oldVisible;
 	SetConsoleCursorInfo(handle, &cci);
-	cout << "\r100% completed." << endl;
 #else
-	cout << "\033[?25h" << "\r100% completed." << endl;
+	cout << "\033[?25h";
 #endif
 
-	// 整理得到的所有解,排序
-	tbb::concurrent_vector<vector<Step>> solutions;
-	tbb::parallel_for_each(results.begin(), results.end(), [&](vector<int> result) {
-		vector<Step> solution;
-		for (int index : result)
-			solution.push_back(steps[index - 1]);
-		std::sort(solution.begin(), solution.end(), [&](const Step& step1, const Step& step2) {
-			return step1.block_index < step2.block_index;
-		});
-		solutions.push_back(solution);
-	});
-	tbb::parallel_sort(solutions.begin(), solutions.end(), [&](const vector<Step>& solution1, const vector<Step>& solution2) {
-		for (int i = 0; i < PIECES; i++)
-		{
-			if (solution1[i].shape_index != solution2[i].shape_index)
-				return solution1[i].shape_index < solution2[i].shape_index;
-			else if (solution1[i].x != solution2[i].x)
-				return solution1[i].x < solution2[i].x;
-			else if (solution1[i].y != solution2[i].y)
-				return solution1[i].y < solution2[i].y;
-		}
-		return false;
-	});
+	// 各子树的解已分段排好序,输出时再多路归并
+	collector.Finish();
+	timer.Mark("sort");
 
 #else
 
@@ -983,6 +5394,8 @@ int main(int argc, const char *argv[])
 	vector<Step> steps;
 	for (Piece piece : pieces)
 		pattern->GetValidSteps(piece, steps);
+	std::sort(steps.begin(), steps.end(), StepOrder);
+	timer.Mark("steps");
 
 	int node_count = 0;
 	node_count = std::accumulate(steps.begin(), steps.end(), 0, [&](int value, Step& step) {
@@ -990,20 +5403,129 @@ int main(int argc, const char *argv[])
 	});
 	node_count += PIECES + pattern->size() + 1;
 
-	DancingLinkX dlx(node_count, steps.size(), pattern->size() + PIECES, (pattern->size() == piece_node_count));
-	for (int i = 0; i < steps.size(); i++)
+	ISolver* solver = NULL;
+	ZddSolver* zdd = NULL;
+	MeetInTheMiddle* mitm = NULL;
+	if (engine == "bitboard")
+		solver = new BitboardSolver(steps.size(), pattern->GetFillOrder());
+	else if (engine == "cells")
+		solver = new DancingCells(steps.size(), pattern->size() + PIECES, (pattern->size() == piece_node_count));
+	else if (engine == "zdd")
+	{
+		solver = zdd = new ZddSolver(steps.size(), pattern->GetFillOrder(), (pattern->size() == piece_node_count));
+		zdd->SetMemo(zdd_memo);
+	}
+	else if (engine == "mitm")
+		solver = mitm = new MeetInTheMiddle(steps.size(), pattern->GetFillOrder(), (pattern->size() == piece_node_count), cut);
+	else
+		solver = CreateDancingLinkX(layout, node_count, steps.size(), pattern->size() + PIECES, (pattern->size() == piece_node_count));
+	solver->SetPruner(pruner);
+
+	Symmetry* symmetry = NULL;
+	if (symmetry_mode != "all")
+	{
+		symmetry = new Symmetry(*pattern, steps, symmetry_mode != "canonical");
+		PrintSymmetry(*symmetry);
+	}
+
+	for (int i = 0; i < (int)(steps.size()); i++)
 	{
+		if (symmetry != NULL && !symmetry->Keep(i + 1))
+			continue;
 		for (int index : steps[i].indecies)
-			dlx.Link(i + 1, index);
-		dlx.Link(i + 1, steps[i].block_index + pattern->size() + 1);
+			solver->Link(i + 1, index);
+		solver->Link(i + 1, steps[i].block_index + pattern->size() + 1);
+	}
+	timer.Mark("matrix");
+
+	SolutionKeys keys(steps);
+	CollectSink collector(keys, symmetry);
+	CountSink counter(breakdown && (int)(pattern->size()) != piece_node_count);
+	std::ofstream stream_out;
+	BinaryWriter* stream_binary = NULL;
+	StreamSink<vector<Step> >* streamer = NULL;
+	if (stream)
+	{
+		stream_out.open(filename, format != "text" ? ios::out | ios::binary : ios::out);
+		if (format != "text")
+			stream_binary = new BinaryWriter(stream_out, type, shard_settings.str(), steps, format == "archive");
+		streamer = new StreamSink<vector<Step> >(*pattern, steps, symmetry, stream_out, stream_binary);
 	}
+	ISolutionSink* sink = &collector;
+	if (count_only)
+		sink = &counter;
+	else if (stream)
+		sink = streamer;
+
+	// 记录检查点时,子树完成后才把其中的解交给sink
+	Checkpoint* checkpoint = NULL;
+	std::ostringstream header;
+	header << "IQPyramidSolver checkpoint 1\ntype " << type << "\nsymmetry " << symmetry_mode
+		<< "\nmode " << (count_only ? "count" : "solutions") << "\nrows " << steps.size() << "\nshard " << shard_index << "/" << shard_count << "\n";
+	if (vm.count("checkpoint"))
+	{
+		checkpoint = new Checkpoint(checkpoint_file, *sink, count_only);
+		sink = checkpoint;
+	}
+	solver->SetSink(sink, symmetry, symmetry_mode == "expand");
+	if (zdd != NULL)
+		zdd->SetCounting(count_only, table);
+	if (mitm != NULL)
+		mitm->SetCounting(count_only);
 
 	vector<vector<int> > steps_list;
+	vector<long long> prefix_counts;
+	SubtreeSolver subtrees(*solver);
 
-	dlx.Spread(0, level, steps_list);
+	// 从检查点继续时使用其中记录的子树
+	if (checkpoint != NULL)
+	{
+		if (!checkpoint->Load(header.str(), steps_list))
+		{
+			std::cerr << checkpoint_file << " is a checkpoint of another puzzle or settings." << endl;
+			return 1;
+		}
+		if (!steps_list.empty())
+			std::cout << "Resuming from checkpoint: " << checkpoint->Completed() << " of " << steps_list.size() << " subtree(s) completed." << endl;
+	}
+
+	// 单核心执行时子树的顺序不影响求解时间,分解子树只影响显示进度的粒度
+	// 抽样时不分解子树,也不求解
+	vector<double> estimates;
+	if (sample_count > 0)
+		SampleSolutions(*zdd, sample_count, seed);
+	else if (!steps_list.empty())
+		estimates = EstimateSubtrees(*solver, steps_list);
+	else if (engine == "mitm")
+	{
+		steps_list.push_back(vector<int>());
+		estimates.push_back(0);
+	}
+	else
+	{
+		if (level == 0)
+		{
+			SplitSubtrees(*solver, vm.count("shard") ? shard_count * SHARD_THREADS : 1, steps_list, estimates);
+			std::cout << "Spread Level: auto, " << steps_list.size() << " subtree(s)" << endl;
+		}
+		else
+		{
+			solver->Spread(0, level, steps_list);
+			estimates = EstimateSubtrees(*solver, steps_list);
+		}
+		if (vm.count("shard"))
+		{
+			SelectShard(steps_list, estimates, shard_index, shard_count);
+			std::cout << "Shard " << shard_index << "/" << shard_count << ": " << steps_list.size() << " subtree(s)" << endl;
+		}
+	}
+	if (checkpoint != NULL)
+		checkpoint->Start(header.str(), steps_list);
+	if (count_only && breakdown)
+		prefix_counts.resize(steps_list.size(), 0);
+	solver->TakeNodes();
+	timer.Mark("split");
 
-	vector<vector<int> > results;
-	int count = 0;
 #if defined(_WIN32) || defined(_WIN64)
 	HANDLE handle = GetStdHandle(STD_OUTPUT_HANDLE);
 	CONSOLE_CURSOR_INFO cci;
@@ -1015,73 +5537,89 @@ int main(int argc, const char *argv[])
 	cout << "\033[?25l" << flush;
 #endif
 
-	for (vector<int> steps : steps_list)
+	// 进度按子树的估计大小加权
+	Progress progress(std::accumulate(estimates.begin(), estimates.end(), 0.0));
+	solver->SetProgress(&progress);
+	for (int i = 0; i < (int)(steps_list.size()); i++)
 	{
-		DancingLinkX clone(dlx);
-		for (int step : steps)
-			clone.KnownStep(step);
-		clone.Dance();
-		for (vector<int> solution : clone.getResult())
-			results.push_back(solution);
-
-		int x = (++count) * 100 / steps_list.size();
-		std::cout << "\r" << x << "% completed." << flush;
+		long long before = counter.Local().total;
+		long long nodes = 0;
+		if (checkpoint == NULL || !checkpoint->Done(i))
+			nodes = subtrees.Solve(steps_list[i]);
+		if (checkpoint != NULL)
+			checkpoint->Commit(i);
+		collector.Seal();
+		if (!prefix_counts.empty())
+			prefix_counts[i] = counter.Local().total - before;
+		progress.Finish(estimates[i], nodes);
 	}
+	progress.Stop();
+	timer.Mark("solve");
 #if defined(_WIN32) || defined(_WIN64)
 	cci.bVisible = oldVisible;
 	SetConsoleCursorInfo(handle, &cci);
-	cout << endl;
 #else
-	cout << "\033[?25h" << endl;
+	cout << "\033[?25h";
 #endif
 
-	vector<vector<Step> > solutions;
-	for (vector<int> result : results)
-	{
-		vector<Step> solution;
-		for (int index : result)
-			solution.push_back(steps[index - 1]);
-		std::sort(solution.begin(), solution.end(), [&](const Step& step1, const Step& step2) {
-			return step1.block_index < step2.block_index;
-		});
-		solutions.push_back(solution);
-	}
-	std::sort(solutions.begin(), solutions.end(), [&](const vector<Step>& solution1, const vector<Step>& solution2) {
-		for (int i = 0; i < PIECES; i++)
-		{
-			if (solution1[i].shape_index != solution2[i].shape_index)
-				return solution1[i].shape_index < solution2[i].shape_index;
-			else if (solution1[i].x != solution2[i].x)
-				return solution1[i].x < solution2[i].x;
-			else if (solution1[i].y != solution2[i].y)
-				return solution1[i].y < solution2[i].y;
-		}
-		return false;
-});
+	collector.Finish();
+	timer.Mark("sort");
 #endif
 
+	// 写出剩余的解
+	long long streamed = 0;
+	if (streamer != NULL)
+		streamed = streamer->Finish();
+
 	// 停止计时
 	auto end = chrono::system_clock::now();
 	auto duration = chrono::duration_cast<chrono::microseconds>(end - start);
 	// 显示消耗时间
 	cout << "Time Spend: " << double(duration.count()) * chrono::microseconds::period::num / chrono::microseconds::period::den << " Seconds" << endl;
-	if (solutions.size() == 0)
+	if (count_only)
+	{
+		// 只输出统计结果
+		CountSink::Counter total = counter.Total();
+		OutputCounts(std::cout, total, steps, steps_list, prefix_counts);
+		if (vm.count("shard"))
+		{
+			std::ofstream fout(filename, ios::out);
+			OutputShardCounts(fout, shard_settings.str(), total);
+		}
+		else if (vm.count("output"))
+		{
+			std::ofstream fout(filename, ios::out);
+			OutputCounts(fout, total, steps, steps_list, prefix_counts);
+		}
+	}
+	else if (stream)
+		std::cout << streamed << " solution(s) written to " << filename << "." << endl;
+	else if (collector.size() == 0)
 		std::cout << "No solution found." << endl;
 	else
-		std::cout << solutions.size() << " solution(s) found." << endl;
+		std::cout << collector.size() << " solution(s) found." << endl;
 
-	if (vm.count("output"))
+	if (count_only || stream)
+		;	// 计数模式已经输出过统计结果,边搜索边输出时解已经写到文件中
+	else if (vm.count("output"))
 	{
 		// 输出结果到文件
-		std::ofstream  fout(filename, ios::out);
+		std::ofstream  fout(filename, format != "text" ? ios::out | ios::binary : ios::out);
 		cout << "Outputing solution(s) to " << filename << "..." << endl;
-		if (solutions.size() == 0)
+		if (format != "text")
+		{
+			BinaryWriter writer(fout, type, shard_settings.str(), steps, format == "archive");
+			collector.Merge([&](const Solution& solution) { writer.Write(solution); });
+			writer.Finish();
+		}
+		else if (collector.size() == 0)
 			fout << "No solution found." << endl;
 		else
 		{
-			fout << solutions.size() << " solution(s) found." << endl << endl;
-			for (vector<Step> solution : solutions)
-				OutputToFile(pattern->FormatMatrix(solution), fout);
+			fout << collector.size() << " solution(s) found." << endl << endl;
+			SolutionRenderer renderer(*pattern, steps, fout, false, columns);
+			collector.Merge([&](const Solution& solution) { renderer.Write(solution); });
+			renderer.Finish();
 		}
 		cout << "Output Complete." << endl;
 	}
@@ -1089,10 +5627,26 @@ int main(int argc, const char *argv[])
 	{
 		// 输出结果到控制台
 		cout << endl;
-		for (vector<Step> solution : solutions)
-			OutputToConsole(pattern->FormatMatrix(solution));
+		SolutionRenderer renderer(*pattern, steps, cout, true, columns);
+		collector.Merge([&](const Solution& solution) { renderer.Write(solution); });
+		renderer.Finish();
+	}
+
+	timer.Mark("output");
+
+	if (vm.count("stats"))
+	{
+		std::ofstream fout(stats_file, ios::out);
+		OutputStats(fout, type, engine, split, level, timer, subtrees);
 	}
 
+	delete checkpoint;
+	delete streamer;
+	delete stream_binary;
+	delete symmetry;
+	delete solver;
+	delete pruner;
+	delete table;
 	delete pattern;
 	return 0;
 }
\ No newline at end of file